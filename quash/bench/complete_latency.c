@@ -0,0 +1,219 @@
+// Keystroke-to-candidates latency of Tab completion, measured through a pty the
+// way a user sees it.
+//
+//   ./complete_latency QUASH [N] [ROUNDS]
+//
+// Creates a temporary PATH directory with N executables (default 5000), starts
+// QUASH on a pty with PATH pointing there, then for ROUNDS rounds (default 1000)
+// types all but the last digit of a random command, presses Tab twice and times
+// until the candidates (ten of them) are listed. The same is then done for file names in a
+// directory of N files. Finally a new executable is created while quash runs
+// and completed, to check the index picked it up without a rescan.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *label, double *samples, int n) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    printf("%-28s mean %8.1f us  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+           label, sum / n, samples[n / 2], samples[(int)(n * 0.99)], samples[n - 1]);
+}
+
+// Function to read from the pty until text shows up. Returns -1 on timeout.
+static int wait_for(int fd, const char *text) {
+    static char buf[65536];
+    static size_t len = 0;
+    double deadline = now_us() + 5e6;
+
+    while (now_us() < deadline) {
+        buf[len] = '\0';
+        char *found = strstr(buf, text);
+        if (found != NULL) {
+            size_t used = found - buf + strlen(text);
+            memmove(buf, buf + used, len - used);
+            len -= used;
+            return 0;
+        }
+        if (len > sizeof(buf) / 2) {
+            memmove(buf, buf + len / 2, len - len / 2);
+            len -= len / 2;
+        }
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) > 0) {
+            ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+            if (n <= 0) {
+                return -1;
+            }
+            len += n;
+        }
+    }
+    return -1;
+}
+
+static void type(int fd, const char *text) {
+    if (write(fd, text, strlen(text)) != (ssize_t)strlen(text)) {
+        perror("write");
+        exit(1);
+    }
+}
+
+// Function to time Tab Tab after command and all but the last digit of a name
+// until that name is listed among the candidates
+static void bench_tab(int fd, const char *label, const char *command, const char *fmt, int n, int rounds) {
+    double *samples = malloc(rounds * sizeof(double));
+    char before[256];
+    char after[256];
+
+    for (int i = 0; i < rounds; i++) {
+        int k = rand() % n;
+        snprintf(after, sizeof(after), fmt, k);
+        strcpy(before, after);
+        before[strlen(before) - 1] = '\0';
+        type(fd, command);
+        type(fd, before);
+        if (wait_for(fd, before) == -1) {
+            fprintf(stderr, "no echo for '%s'\n", before);
+            exit(1);
+        }
+        double t0 = now_us();
+        type(fd, "\t\t");
+        if (wait_for(fd, after) == -1) {
+            fprintf(stderr, "'%s' did not list '%s'\n", before, after);
+            exit(1);
+        }
+        samples[i] = now_us() - t0;
+        type(fd, "\x15");  // Ctrl-U: clear the line
+        wait_for(fd, "$ ");
+    }
+    report(label, samples, rounds);
+    free(samples);
+}
+
+static void make_files(const char *dir, const char *prefix, int n, mode_t mode) {
+    char path[512];
+    mkdir(dir, 0700);
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/%s%05d", dir, prefix, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+        if (fd == -1 || write(fd, "#!/bin/sh\n", 10) != 10) {
+            perror(path);
+            exit(1);
+        }
+        close(fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s QUASH [N] [ROUNDS]\n", argv[0]);
+        return 2;
+    }
+    int n = argc > 2 ? atoi(argv[2]) : 5000;
+    int rounds = argc > 3 ? atoi(argv[3]) : 1000;
+    if (n < 1 || n > 99999) {
+        n = 5000;
+    }
+    if (rounds < 1) {
+        rounds = 1;
+    }
+
+    char *quash = realpath(argv[1], NULL);  // The child runs in another directory
+    if (quash == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    char root[] = "/tmp/quash-complete-XXXXXX";
+    if (mkdtemp(root) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char bin[512];
+    char files[512];
+    char path_env[1024];
+    char home[512];
+    snprintf(bin, sizeof(bin), "%s/bin", root);
+    snprintf(files, sizeof(files), "%s/files", root);
+    snprintf(path_env, sizeof(path_env), "%s:/usr/bin:/bin", bin);
+    snprintf(home, sizeof(home), "%s", root);
+    make_files(bin, "qcmd", n, 0755);
+    make_files(files, "file", n, 0644);
+    sleep(2);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("posix_openpt");
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        setsid();
+        int slave = open(ptsname(master), O_RDWR);
+        if (slave == -1) {
+            _exit(127);
+        }
+        dup2(slave, 0);
+        dup2(slave, 1);
+        dup2(slave, 2);
+        close(slave);
+        close(master);
+        setenv("PATH", path_env, 1);
+        setenv("HOME", home, 1);  // Keeps the benchmark out of the real history
+        if (chdir(files) == -1) {
+            _exit(127);
+        }
+        execl(quash, quash, (char *)NULL);
+        _exit(127);
+    }
+    if (wait_for(master, "$ ") == -1) {
+        fprintf(stderr, "quash did not show a prompt\n");
+        return 1;
+    }
+
+    printf("%d executables in PATH, %d files, %d rounds\n", n, n, rounds);
+    bench_tab(master, "command candidates", "", "qcmd%05d", n, rounds);
+    bench_tab(master, "file candidates", "cat ", "file%05d", n, rounds);
+
+    // A command that appears while quash runs must be found without a rescan
+    char created[600];
+    snprintf(created, sizeof(created), "%s/qnewcommand", bin);
+    int fd = open(created, O_WRONLY | O_CREAT, 0755);
+    close(fd);
+    usleep(10000);
+    type(master, "qnewcomm\t");
+    printf("new executable completed:    %s\n", wait_for(master, "qnewcommand") == 0 ? "yes" : "NO");
+    type(master, "\x15");
+
+    type(master, "exit\r");
+    waitpid(pid, NULL, 0);
+
+    char cleanup[600];
+    snprintf(cleanup, sizeof(cleanup), "rm -rf %s", root);
+    if (system(cleanup) != 0) {
+        fprintf(stderr, "could not remove %s\n", root);
+    }
+    return 0;
+}
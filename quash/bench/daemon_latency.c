@@ -0,0 +1,146 @@
+// Submit->start latency of 'quash --daemon' compared with starting a fresh quash
+// per request (what the old wrapper scripts did).
+//
+//   ./daemon_latency SOCKET [N] [QUASH]
+//
+// Daemon mode: sends 'run true' N times over SOCKET and times the arrival of the
+// 'started' reply (submit->start) and of the 'exit' reply (submit->exit).
+// If QUASH is given, also runs 'true' through N fresh 'QUASH' processes fed on
+// stdin and times each until it exits.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *label, double *samples, int n) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    printf("%-28s mean %8.1f us  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+           label, sum / n, samples[n / 2], samples[(int)(n * 0.99)], samples[n - 1]);
+}
+
+// Function to read one reply line from the daemon
+static int read_reply(int fd, char *line, size_t size) {
+    size_t len = 0;
+    while (len + 1 < size) {
+        ssize_t n = read(fd, line + len, 1);
+        if (n <= 0) {
+            return -1;
+        }
+        if (line[len++] == '\n') {
+            break;
+        }
+    }
+    line[len] = '\0';
+    return 0;
+}
+
+static void bench_daemon(const char *path, int n) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(path);
+        exit(1);
+    }
+
+    double *start = malloc(n * sizeof(double));
+    double *finish = malloc(n * sizeof(double));
+    char line[256];
+    for (int i = 0; i < n; i++) {
+        double t0 = now_us();
+        if (write(fd, "run true\n", 9) != 9) {
+            perror("write");
+            exit(1);
+        }
+        while (1) {
+            if (read_reply(fd, line, sizeof(line)) == -1) {
+                fprintf(stderr, "daemon closed the connection\n");
+                exit(1);
+            }
+            if (strncmp(line, "started ", 8) == 0) {
+                start[i] = now_us() - t0;
+            } else if (strncmp(line, "exit ", 5) == 0) {
+                finish[i] = now_us() - t0;
+                break;
+            } else if (strncmp(line, "error ", 6) == 0) {
+                fprintf(stderr, "%s", line);
+                exit(1);
+            }
+        }
+    }
+    close(fd);
+
+    report("daemon submit->start", start, n);
+    report("daemon submit->exit", finish, n);
+    free(start);
+    free(finish);
+}
+
+static void bench_fork_per_request(const char *quash, int n) {
+    double *finish = malloc(n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        int fds[2];
+        double t0 = now_us();
+        if (pipe(fds) == -1) {
+            perror("pipe");
+            exit(1);
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(fds[0], STDIN_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            execl(quash, quash, (char *)NULL);
+            _exit(127);
+        }
+        close(fds[0]);
+        if (write(fds[1], "true\n", 5) != 5) {
+            perror("write");
+        }
+        close(fds[1]);
+        waitpid(pid, NULL, 0);
+        finish[i] = now_us() - t0;
+    }
+    report("fresh quash per request", finish, n);
+    free(finish);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s SOCKET [N] [QUASH]\n", argv[0]);
+        return 2;
+    }
+    int n = argc > 2 ? atoi(argv[2]) : 1000;
+    if (n < 1) {
+        n = 1;
+    }
+
+    bench_daemon(argv[1], n);
+    if (argc > 3) {
+        bench_fork_per_request(argv[3], n);
+    }
+    return 0;
+}
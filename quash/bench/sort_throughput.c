@@ -0,0 +1,135 @@
+// Throughput of the sort builtin against GNU sort run with LC_ALL=C (the same
+// bytewise order).
+//
+//   ./sort_throughput QUASH [MB] [BUFFER]
+//
+// Writes MB megabytes (default 1024) of 'word,number,word' lines to a temporary
+// directory, then sorts them with both in a few modes, each with -S BUFFER
+// (default 256M) so an input larger than that spills runs to disk. Outputs must
+// be identical; the time and GB/s of input sorted are printed for each.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_random() {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static void write_input(const char *path, long long bytes) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        exit(1);
+    }
+    long long written = 0;
+    char line[128];
+    while (written < bytes) {
+        int len = 0;
+        int word = 6 + next_random() % 15;
+        for (int i = 0; i < word; i++) {
+            line[len++] = 'a' + next_random() % 26;
+        }
+        len += sprintf(line + len, ",%llu,", (unsigned long long)(next_random() % 1000000000));
+        for (int i = 0; i < 8; i++) {
+            line[len++] = 'a' + next_random() % 26;
+        }
+        line[len++] = '\n';
+        fwrite(line, 1, len, out);
+        written += len;
+    }
+    fclose(out);
+}
+
+// Function to run a command to completion and return how long it took
+static double run(char *const argv[]) {
+    double t0 = now_s();
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("LC_ALL", "C", 1);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed\n", argv[0]);
+        exit(1);
+    }
+    return now_s() - t0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s QUASH [MB] [BUFFER]\n", argv[0]);
+        return 2;
+    }
+    long long mb = argc > 2 ? atoll(argv[2]) : 1024;
+    const char *buffer = argc > 3 ? argv[3] : "256M";
+    static const char *modes[][2] = {
+        { "whole line", "" },
+        { "-t, -k2,2n", "-t, -k2,2n" },
+        { "-r", "-r" },
+        { "-u -t, -k3,3", "-u -t, -k3,3" },
+    };
+
+    char dir[] = "/tmp/quash-sort-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char input[512];
+    char expected[512];
+    char got[512];
+    char script[512];
+    char command[2048];
+    snprintf(input, sizeof(input), "%s/input", dir);
+    snprintf(expected, sizeof(expected), "%s/gnu.out", dir);
+    snprintf(got, sizeof(got), "%s/quash.out", dir);
+    snprintf(script, sizeof(script), "%s/sort.qsh", dir);
+    write_input(input, mb << 20);
+    printf("%lld MB input, -S %s\n", mb, buffer);
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        // GNU sort through sh so the options split the same way
+        snprintf(command, sizeof(command), "sort -S %s %s %s -o %s", buffer, modes[m][1], input, expected);
+        char *gnu[] = { "sh", "-c", command, NULL };
+        double gnu_time = run(gnu);
+
+        FILE *f = fopen(script, "w");
+        if (f == NULL) {
+            perror(script);
+            return 1;
+        }
+        fprintf(f, "sort -S %s %s %s > %s\n", buffer, modes[m][1], input, got);
+        fclose(f);
+        char *quash[] = { argv[1], "--norc", script, NULL };
+        double quash_time = run(quash);
+
+        snprintf(command, sizeof(command), "cmp -s %s %s", expected, got);
+        int same = (system(command) == 0);
+        printf("%-16s GNU sort %7.2f s %6.3f GB/s   quash %7.2f s %6.3f GB/s   %s\n", modes[m][0],
+               gnu_time, mb / 1024.0 / gnu_time, quash_time, mb / 1024.0 / quash_time,
+               same ? "same output" : "OUTPUT DIFFERS");
+    }
+
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    if (system(command) != 0) {
+        fprintf(stderr, "could not remove %s\n", dir);
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Startup time of quash with a large ~/.quashrc: cold (the rc is parsed and its
+// snapshot written) against warm (the snapshot is mapped), with --norc as the floor.
+//
+//   ./startup_latency QUASH [LINES] [RUNS]
+//
+// Writes an rc of about LINES lines (default 5000) of exports, assignments,
+// loops and conditionals into a temporary HOME, then runs 'QUASH /dev/null'
+// RUNS times (default 200) in each mode and times each run until it exits.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *label, double *samples, int n) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    printf("%-28s mean %8.1f us  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+           label, sum / n, samples[n / 2], samples[(int)(n * 0.99)], samples[n - 1]);
+}
+
+static void write_rc(const char *path, int lines) {
+    FILE *rc = fopen(path, "w");
+    if (rc == NULL) {
+        perror(path);
+        exit(1);
+    }
+    for (int i = 0; i < lines / 10; i++) {
+        fprintf(rc, "# block %d\n", i);
+        fprintf(rc, "export QUASH_BENCH_%d=/opt/tool%d/bin\n", i, i);
+        fprintf(rc, "SETTING_%d=\"value $HOME %d\"\n", i, i);
+        fprintf(rc, "if true; then\n");
+        fprintf(rc, "    MODE_%d=on\n", i);
+        fprintf(rc, "else\n");
+        fprintf(rc, "    MODE_%d=off\n", i);
+        fprintf(rc, "fi\n");
+        fprintf(rc, "for part in a b; do LAST_%d=$part; done\n", i);
+        fprintf(rc, "true && OK_%d=1 || OK_%d=0\n", i, i);
+    }
+    fclose(rc);
+}
+
+static double run_quash(const char *quash, const char *home, int norc) {
+    double t0 = now_us();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        setenv("HOME", home, 1);
+        unsetenv("QUASHRC");
+        unsetenv("XDG_CACHE_HOME");
+        if (norc) {
+            execl(quash, quash, "--norc", "/dev/null", (char *)NULL);
+        } else {
+            execl(quash, quash, "/dev/null", (char *)NULL);
+        }
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed\n", quash);
+        exit(1);
+    }
+    return now_us() - t0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s QUASH [LINES] [RUNS]\n", argv[0]);
+        return 2;
+    }
+    int lines = argc > 2 ? atoi(argv[2]) : 5000;
+    int runs = argc > 3 ? atoi(argv[3]) : 200;
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    char home[] = "/tmp/quash-startup-XXXXXX";
+    if (mkdtemp(home) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char rc[512];
+    char cleanup[600];
+    snprintf(rc, sizeof(rc), "%s/.quashrc", home);
+    write_rc(rc, lines);
+    snprintf(cleanup, sizeof(cleanup), "rm -rf %s/.cache", home);
+
+    double *samples = malloc(runs * sizeof(double));
+    printf("rc of %d lines, %d runs\n", lines, runs);
+
+    for (int i = 0; i < runs; i++) {
+        samples[i] = run_quash(argv[1], home, 1);
+    }
+    report("no rc (--norc)", samples, runs);
+
+    for (int i = 0; i < runs; i++) {
+        if (system(cleanup) != 0) {
+            fprintf(stderr, "could not remove the snapshot\n");
+            return 1;
+        }
+        samples[i] = run_quash(argv[1], home, 0);
+    }
+    report("cold (parse + snapshot)", samples, runs);
+
+    for (int i = 0; i < runs; i++) {
+        samples[i] = run_quash(argv[1], home, 0);
+    }
+    report("warm (snapshot)", samples, runs);
+
+    free(samples);
+    snprintf(cleanup, sizeof(cleanup), "rm -rf %s", home);
+    if (system(cleanup) != 0) {
+        fprintf(stderr, "could not remove %s\n", home);
+    }
+    return 0;
+}
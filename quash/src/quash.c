@@ -1,3 +1,4 @@
+#define _GNU_SOURCE  // sched_setaffinity and cpu_set_t
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,34 +8,394 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <strings.h>
+#include <termios.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 
 #define MAX_INPUT_SIZE 1024
 #define MAX_ARG_COUNT 100
-#define MAX_JOBS 100
+#define JOB_TABLE_INITIAL 64
 
+#define OUT_BUF_SIZE 65536  // Bytes buffered per fd before a forced flush
+#define OUT_MAX_FDS 8       // Number of fds that can hold buffered output at once
+
+#define PARSE_CACHE_CAPACITY 256  // Parsed command trees kept for reuse
+#define PARSE_CACHE_BUCKETS 512   // Hash buckets for the parse cache (power of two)
+#define SHELL_VAR_BUCKETS 1024    // Hash buckets for shell variables (power of two)
+#define USER_COMMAND_BUCKETS 256  // Hash buckets for aliases and functions (power of two)
+#define BUILTIN_SLOTS 64          // Builtin table size; BUILTIN_SLOT places each builtin
+#define MAX_FUNCTION_DEPTH 1000   // Nested function calls allowed
+
+#define GETDENTS_BUF_SIZE 131072     // Directory read buffer for globbing
+#define GLOB_DIR_CACHE_SIZE 64       // Directory listings kept with 'set -o globcache'
+#define GLOB_PATTERN_CACHE_SIZE 32   // Recently compiled glob patterns
+
+#define COMPLETE_DIR_CACHE_SIZE 8    // Directory listings kept for file completion
+#define COMPLETE_LIST_MAX 200        // Candidates listed on a second Tab
+#define PATH_INDEX_MAX_DIRS 64       // PATH directories indexed for command completion
+
+#define MAX_CHILD_LIMITS 8           // Resource limits one command prefix can set
+#define MAX_SAVED_FDS 16             // Redirections of one builtin that can be undone
+
+#define CAPTURE_RING_SIZE 65536      // Bytes of output kept per captured background job
+#define READ_BUF_SIZE 4096           // Input read buffer for the main loop
+
+#define SORT_MEMORY_DEFAULT (512L << 20)  // Bytes 'sort' buffers before spilling a run (-S)
+#define SORT_MAX_THREADS 16               // Threads sorting one buffer
+#define SORT_MERGE_WAY 64                 // Runs merged at once; more cost another pass
+#define SORT_IO_SIZE (1 << 20)            // Read and write size for 'sort'
+
+
+// Last CAPTURE_RING_SIZE bytes a background job wrote (allocated on first output)
+typedef struct {
+    char *data;
+    size_t alloc;                // Bytes allocated, at most CAPTURE_RING_SIZE
+    unsigned long long total;    // Bytes ever written; older ones were overwritten
+} OutputRing;
 
 // Job structure
 typedef struct {
     int job_id;
-    pid_t pid;
+    pid_t pid;         // Process whose exit status is the job's
+    pid_t pgid;        // Process group of the job, 0 if it shares the shell's
     char command[MAX_INPUT_SIZE];
     int active;
+    int stopped;       // Suspended (Ctrl-Z, SIGSTOP) until fg/bg continues it
+    int timed_out;     // Its deadline passed and it was signalled
+    int exit_status;   // Raw waitpid status once the job has been reaped
+    int captured;      // Output goes to 'output' instead of the terminal
+    int capture_fd;    // Read end of the capture pipe, -1 once the job's output ended
+    OutputRing output;
 } Job;
 
-// Global job list
-Job jobs[MAX_JOBS];
+// Global job list (grows on demand)
+Job *jobs = NULL;
 int job_count = 0;
+int job_capacity = 0;
+int last_job_id = 0;  // Id given to the most recently added job
+
+// Output buffer for a single fd, filled by builtins and flushed with writev
+typedef struct {
+    int fd;            // -1 when the slot is unused
+    size_t len;
+    char data[OUT_BUF_SIZE];
+} OutBuf;
+
+OutBuf out_bufs[OUT_MAX_FDS];
+int out_bufs_ready = 0;
+
+// File descriptor watched by the event loop
+typedef void (*EventHandler)(int fd, void *ctx);
+
+typedef struct {
+    int fd;
+    EventHandler handler;
+    EventHandler on_writable;  // Called when fd can take more output, if set
+    void *ctx;
+} EventSource;
+
+EventSource *event_sources = NULL;
+int event_count = 0;
+int event_capacity = 0;
+int sigchld_pipe[2] = { -1, -1 };  // Written by the SIGCHLD handler to wake up poll()
+int capture_open = 0;              // Capture pipes still being drained
+
+// Buffered line input for the main loop
+typedef struct {
+    int fd;
+    char buf[READ_BUF_SIZE];
+    size_t start;
+    size_t end;
+    int eof;
+} LineReader;
+
+// Token types produced by the lexer
+typedef enum {
+    TOK_WORD,
+    TOK_NEWLINE,
+    TOK_SEMI,
+    TOK_AMP,
+    TOK_PIPE,
+    TOK_AND_IF,
+    TOK_OR_IF,
+    TOK_EOF
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    char *text;  // Raw word text with quotes kept, NULL for operators
+} Token;
+
+// Parser state over a token array
+typedef struct {
+    Token *toks;
+    int pos;
+    int incomplete;  // Input ended inside a construct
+    int error;       // A syntax error was already reported
+} Parser;
+
+// Parsed command tree node types
+typedef enum {
+    NODE_SIMPLE,     // words
+    NODE_PIPELINE,   // stages chained through body/next
+    NODE_AND,        // left && right
+    NODE_OR,         // left || right
+    NODE_LIST,       // items chained through body/next, each may run in background
+    NODE_FOR,        // for name in words; do body; done
+    NODE_WHILE,      // while cond; do body; done
+    NODE_UNTIL,      // until cond; do body; done
+    NODE_IF,         // if cond; then body; else else_part; fi
+    NODE_FUNCTION    // name() { body; }: defines the function when run
+} NodeType;
+
+typedef struct Node {
+    NodeType type;
+    char **words;            // Unexpanded words (NULL-terminated)
+    int word_count;
+    char *name;              // Loop variable of a for loop, or the function being defined
+    struct Node *cond;
+    struct Node *body;
+    struct Node *else_part;
+    struct Node *left;
+    struct Node *right;
+    struct Node *next;       // Next sibling in a list or pipeline
+    int background;          // List item was followed by '&'
+    int negate;              // Pipeline was prefixed with '!'
+} Node;
+
+// Shell variable set by NAME=value or a for loop (not exported to children)
+typedef struct ShellVar {
+    char *name;
+    char *value;
+    struct ShellVar *next;
+} ShellVar;
+
+// Growable argv built during word expansion
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+} ArgList;
+
+// Growable string used while building a field
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+// Field being produced by word expansion
+typedef struct {
+    StrBuf text;      // Expanded text
+    StrBuf pattern;   // Same text with quoted wildcard characters escaped
+    int have;         // Something (even an empty quoted string) was produced
+    int glob;         // An unquoted wildcard appeared
+} Field;
+
+// Compiled glob pattern: one opcode list per '/'-separated segment
+typedef enum {
+    GLOB_LITERAL,
+    GLOB_ANY,         // ?
+    GLOB_STAR,        // *
+    GLOB_CLASS        // [...]
+} GlobOpType;
+
+typedef struct {
+    unsigned char type;
+    unsigned char ch;         // GLOB_LITERAL character
+    unsigned char negate;     // GLOB_CLASS was [!...] or [^...]
+    unsigned char bits[32];   // GLOB_CLASS member bitmap
+} GlobOp;
+
+typedef struct {
+    char *literal;    // Whole segment when it has no wildcards, else NULL
+    GlobOp *ops;
+    int nops;
+    int doublestar;   // Segment is exactly '**'
+    int dot_ok;       // Starts with '.', so hidden names may match
+    char *suffix;     // Literal text after the last '*' (quick reject), or NULL
+    size_t suffix_len;
+} GlobSegment;
+
+typedef struct {
+    char *source;
+    GlobSegment *segs;
+    int nsegs;
+    int absolute;
+    int dirs_only;    // Pattern ended in '/'
+} GlobPattern;
+
+// Directory contents read with getdents64
+typedef struct {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;    // Directory mtime when it was read
+    int racy;                 // Read too close to the last change to trust later
+    char *names;              // NUL-separated entry names
+    size_t names_len;
+    int *offsets;             // Start of each name in names
+    unsigned char *types;     // d_type of each entry
+    int count;
+} DirListing;
+
+DirListing *dir_cache[GLOB_DIR_CACHE_SIZE];
+unsigned long dir_cache_hits = 0;
+unsigned long dir_cache_misses = 0;
+
+// Shell options toggled with 'set -o NAME' / 'set +o NAME'
+int opt_globcache = 0;   // Reuse directory listings while their mtime is unchanged
+int opt_noglob = 0;      // Leave wildcards unexpanded
+int opt_autoaffinity = 0;  // Pin each pipeline stage to its own CPU
+int opt_capture = 0;     // Keep background job output in per-job rings
+long opt_deadline_ms = 0;       // 'set -o deadline=DURATION': limit for every background job
+long opt_kill_grace_ms = 5000;  // 'set -o killgrace=DURATION': SIGTERM -> SIGKILL delay
+
+typedef struct {
+    const char *name;
+    int *value;
+} ShellOption;
+
+ShellOption shell_options[] = {
+    { "globcache", &opt_globcache },
+    { "noglob", &opt_noglob },
+    { "autoaffinity", &opt_autoaffinity },
+    { "capture", &opt_capture },
+    { NULL, NULL }
+};
+
+// Options that take a duration ('set -o deadline=30s'); 'set +o NAME' sets them to 0
+typedef struct {
+    const char *name;
+    long *value;
+} DurationOption;
+
+DurationOption duration_options[] = {
+    { "deadline", &opt_deadline_ms },
+    { "killgrace", &opt_kill_grace_ms },
+    { NULL, NULL }
+};
+
+// Parse cache entry: source text and its immutable command tree. Entries are
+// reference counted so eviction never frees a tree that is still executing.
+typedef struct CacheEntry {
+    uint64_t hash;
+    char *source;
+    Node *tree;
+    int refs;                       // Users currently holding the tree
+    int cached;                     // Still reachable from the cache
+    struct CacheEntry *hash_next;
+    struct CacheEntry *lru_prev;    // Towards most recently used
+    struct CacheEntry *lru_next;    // Towards least recently used
+} CacheEntry;
+
+CacheEntry *parse_cache[PARSE_CACHE_BUCKETS];
+CacheEntry *lru_head = NULL;
+CacheEntry *lru_tail = NULL;
+int parse_cache_size = 0;
+unsigned long parse_cache_hits = 0;
+unsigned long parse_cache_misses = 0;
+unsigned long parse_cache_evictions = 0;
+
+int last_status = 0;       // Exit status of the last command ($?)
+int builtin_status = 0;    // Exit status reported by the builtin that just ran
+int loop_depth = 0;        // Number of enclosing for/while/until loops
+int break_levels = 0;      // Pending 'break N'
+int continue_levels = 0;   // Pending 'continue N'
+int return_pending = 0;    // 'return' is unwinding the running function
+volatile sig_atomic_t interrupted = 0;  // Ctrl-C: abandon the rest of the command line
+pid_t daemon_pid = 0;      // Set in 'quash --daemon'; its jobs share our atexit handlers
+int function_depth = 0;    // Number of function calls being run
+char **positional_args = NULL;  // $1, $2, ... of the running function
+int positional_count = 0;       // $#
+ShellVar *shell_vars[SHELL_VAR_BUCKETS];  // Shell variables hashed by name
+
+// What to change in a child between fork and execvp ('@cpus=0-3', 'limit mem=2G', ...)
+typedef struct {
+    int has_cpus;
+    cpu_set_t cpus;
+    int has_nice;
+    int nice;
+    int nlimits;
+    struct {
+        int resource;
+        rlim_t value;
+    } limits[MAX_CHILD_LIMITS];
+    long timeout_ms;       // 'timeout DURATION': enforced by the shell, 0 = none
+    int timeout_signal;
+    long grace_ms;         // SIGKILL this long after timeout_signal, 0 = never
+} ChildSetup;
+
+const ChildSetup *child_setup = NULL;  // Setup for the command being started, if any
+
+// Descriptors a builtin's redirections replaced in the shell, to put back afterwards
+typedef struct {
+    int count;
+    int fd[MAX_SAVED_FDS];
+    int saved[MAX_SAVED_FDS];  // Copy of what fd pointed at, -1 if it was closed
+} SavedFds;
+
+int job_control = 0;     // Interactive shell owning the terminal: foreground jobs get it
+int in_subshell = 0;     // Forked child of the shell; stays in its job's process group
+pid_t shell_pgid = 0;
 
 // Function prototypes
 int handle_kill_command(char **args);
 void kill_job_by_pid(int pid);
-void execute_command(char *input);
+int execute_command(char *input);
 int handle_builtin_commands(char **args);
-void execute_external_command(char **args, int background);
+int execute_external_command(char **args, int background);
+int execute_simple_command(char **args, int background);
 void check_background_jobs();
 void add_job(pid_t pid, char *command);
 void print_jobs();
+void reap_jobs();
+void init_job_control();
+pid_t job_group_for(int background);
+int wait_for_foreground(pid_t *pids, int count, const char *label);
+int wait_for_job(Job *job);
+void quash_fg(char **args);
+void quash_bg(char **args);
+const char *job_label(Node *node);
+int run_daemon(const char *path);
+int run_client(const char *path, const char *request);
+void history_open();
+void history_add(const char *text);
+void history_save_index();
+void quash_history(char **args);
+int edit_line(const char *prompt, StrBuf *line);
+void path_index_sync();
+void quash_compgen(char **args);
+void command_names(const char *prefix, ArgList *out);
+int is_function_call(Node *node);
+void expand_command_words(Node *node, ArgList *out);
+void define_function(const char *name, Node *body);
+void quash_alias(char **args);
+void quash_unalias(char **args);
+void quash_unset(char **args);
+void quash_type(char **args);
+void quash_return(char **args);
+void quash_shift(char **args);
 void remove_job(pid_t pid);
+void drop_job(Job *job);
 void kill_process(char **args);
 void kill_job_by_id(int job_id);
 void export_variable(char *arg);
@@ -45,792 +406,8376 @@ void quash_pwd();
 void quash_echo(char **args);
 void quash_cd(char **args);
 void sigchld_handler(int sig);
-void execute_pipeline(char ***commands, int num_commands);
+int execute_pipeline(Node *stages);
+void exec_pipeline_stage(Node *stage);
+void exec_args_in_child(char **args);
+int parse_command_prefixes(char **args, ChildSetup *setup);
+int apply_child_setup(const ChildSetup *setup);
+void pin_to_nth_cpu(int n);
+void quash_taskset(char **args);
+void quash_ulimit(char **args);
 void handle_cat(char **args);
-// Helper function to tokenize input
-char **tokenize_input(char *input);
+void quash_sort(char **args);
+void quash_loop_control(char **args);
+int status_from_wait(int status);
+int apply_redirections(char **args, SavedFds *saved);
+void restore_redirections(SavedFds *saved);
+// Parser and interpreter prototypes
+Node *parse_input(const char *src, int *incomplete);
+void free_node(Node *node);
+Node *copy_node(Node *node);
+int exec_node(Node *node);
+CacheEntry *parse_cached(const char *src, int *incomplete);
+void release_parsed(CacheEntry *entry);
+void quash_cache(char **args);
+void run_rc_file();
+int is_valid_name(const char *name, size_t len);
+int is_assignment_only(Node *node);
+void expand_word(const char *raw, ArgList *out, int split);
+void arglist_push(ArgList *list, char *item);
+void arglist_free(ArgList *list);
+const char *lookup_variable(const char *name);
+void set_shell_variable(const char *name, const char *value);
+void unset_shell_variable(const char *name);
+int glob_expand(const char *pattern_text, ArgList *out);
+DirListing *get_dir_listing(const char *path, int *owned);
+DirListing *cached_dir_listing(DirListing **cache, int size, int *next_slot, const char *path, int *hit);
+void clear_dir_cache();
+void quash_set(char **args);
+void strbuf_putn(StrBuf *sb, const char *s, size_t n);
+// Event loop and job output capture prototypes
+void init_event_loop();
+void reset_child_events();
+int event_loop_once(int timeout_ms, int watch_fd);
+int wait_for_child(pid_t pid);
+int read_line(LineReader *reader, StrBuf *line);
+int capture_begin(int fds[2]);
+void capture_child(int fds[2]);
+void capture_attach(int fds[2]);
+void capture_poll();
+void show_job_output(char *spec, int follow);
+// Timeout prototypes
+int parse_duration(const char *text, long *ms);
+void format_duration(long ms, char *buf, size_t size);
+int parse_signal(const char *text);
+int deadline_start(pid_t target, int job_id, long ms, int sig, long grace_ms);
+int deadline_cancel(int fd);
+void deadline_attach(int fd, int job_id);
+void cancel_job_deadline(int job_id);
+void arm_job_deadline(const ChildSetup *setup);
+void reset_child_deadlines();
+int deadlines_pending();
+// Buffered output prototypes
+void out_write(int fd, const char *data, size_t len);
+void out_printf(int fd, const char *fmt, ...);
+void out_flush(int fd);
+void out_flush_all();
+void out_close(int fd);
+void out_order_stderr();
+pid_t quash_fork();
+pid_t fork_job(pid_t pgid, int foreground);
 
 // Main function to handle Quash shell loop
-int main() {
-    char input[MAX_INPUT_SIZE];
-    printf("WELCOME TO QUASH\n");
-    printf("\n");
+int main(int argc, char *argv[]) {
+    LineReader reader = { .fd = STDIN_FILENO };
+    StrBuf line = {0};
+    StrBuf pending = {0};      // Text of the command being read (may span several lines)
+    atexit(out_flush_all);  // 'exit' must not drop buffered builtin output
+    out_order_stderr();
 
+    // 'quash --daemon --socket PATH' serves clients; '--send REQUEST' is one such client
+    const char *socket_path = NULL;
+    const char *request = NULL;
+    int daemon_mode = 0;
+    int norc = 0;
+    int argi = 1;
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (strcmp(argv[argi], "--daemon") == 0) {
+            daemon_mode = 1;
+        } else if (strcmp(argv[argi], "--socket") == 0 && argi + 1 < argc) {
+            socket_path = argv[++argi];
+        } else if (strcmp(argv[argi], "--send") == 0 && argi + 1 < argc) {
+            request = argv[++argi];
+        } else if (strcmp(argv[argi], "--norc") == 0) {
+            norc = 1;
+        } else {
+            fprintf(stderr, "Usage: quash [--norc] [script] | quash --daemon --socket PATH | quash --socket PATH --send REQUEST\n");
+            return 2;
+        }
+    }
+    if ((daemon_mode || request != NULL) && socket_path == NULL) {
+        fprintf(stderr, "quash: --socket PATH is required\n");
+        return 2;
+    }
+    if (daemon_mode) {
+        return run_daemon(socket_path);
+    }
+    if (request != NULL) {
+        return run_client(socket_path, request);
+    }
 
-    while (1) {
-        printf("quash$ ");
-       
-        if (fgets(input, MAX_INPUT_SIZE, stdin) == NULL) {
-            perror("Error reading input");
-            continue;
+    // 'quash script.qsh' runs the script instead of reading stdin
+    if (argi < argc) {
+        reader.fd = open(argv[argi], O_RDONLY | O_CLOEXEC);
+        if (reader.fd == -1) {
+            perror(argv[argi]);
+            return 127;
         }
+    }
+    int interactive = (reader.fd == STDIN_FILENO && isatty(STDIN_FILENO));
 
-        // Remove newline from input
-        input[strcspn(input, "\n")] = 0;
+    init_event_loop();
+    if (interactive) {
+        init_job_control();
+        history_open();
+    }
+    if (!norc) {
+        run_rc_file();
+    }
 
-        // Check if input contains a pipeline
-        if (strchr(input, '|') != NULL) {
-            // Split the input by pipe character '|'
-            char *pipe_segments[MAX_ARG_COUNT];
-            int num_commands = 0;
-            char *pipe_token = strtok(input, "|");
+    if (interactive) {
+        out_printf(STDOUT_FILENO, "WELCOME TO QUASH\n");
+        out_printf(STDOUT_FILENO, "\n");
+    }
 
-            while (pipe_token != NULL && num_commands < MAX_ARG_COUNT) {
-                pipe_segments[num_commands++] = pipe_token;
-                pipe_token = strtok(NULL, "|");
-            }
+    while (1) {
+        out_flush_all();  // Make sure earlier output is out before blocking on input
 
-            // Allocate and tokenize each command
-            char **commands[MAX_ARG_COUNT];
-            for (int i = 0; i < num_commands; i++) {
-                commands[i] = tokenize_input(pipe_segments[i]);
+        // Background work (captured job output) is serviced while we wait here
+        if (interactive) {
+            // Secondary prompt while a compound command is still open
+            int got = edit_line(pending.len == 0 ? "quash$ " : "> ", &line);
+            if (got == 0) {
+                break;
+            }
+            if (got < 0) {
+                pending.len = 0;  // Ctrl-C drops the whole command
+                continue;
             }
+        } else if (!read_line(&reader, &line)) {
+            break;
+        }
+        strbuf_putn(&pending, line.data, line.len);
 
-            // Pass commands and number of commands to execute_pipeline
-            execute_pipeline(commands, num_commands);
-            // Free allocated memory for commands
-            for (int i = 0; i < num_commands; i++) {
-                free(commands[i]);
+        int incomplete = 0;
+        CacheEntry *parsed = parse_cached(pending.data, &incomplete);
+        if (incomplete) {
+            continue;  // Keep reading until 'done', 'fi', closing quote, ...
+        }
+        if (interactive) {
+            history_add(pending.data);
+        }
+        if (parsed != NULL) {
+            interrupted = 0;
+            exec_node(parsed->tree);
+            release_parsed(parsed);
+            if (interrupted) {
+                interrupted = 0;
+                out_printf(STDOUT_FILENO, "\n");  // The terminal only echoed ^C
             }
-        
-        } 
-        else {
-           execute_command(input);
+        } else {
+            last_status = 2;
         }
+        pending.len = 0;
+
+        // Command finished; push out anything the builtins buffered
+        out_flush_all();
     }
 
-    return 0;
+    if (pending.len > 0) {
+        fprintf(stderr, "quash: syntax error: unexpected end of file\n");
+        last_status = 2;
+    }
+    free(pending.data);
+    free(line.data);
+    return last_status;
 }
 
+// SIGCHLD only wakes up the event loop; children are reaped by whoever waits for them
 void sigchld_handler(int sig) {
-    // Wait for all dead child processes
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+    int saved_errno = errno;
+    (void)sig;
+    if (write(sigchld_pipe[1], "c", 1) == -1) {
+        // Pipe already full: a wake-up is pending anyway
+    }
+    errno = saved_errno;
+}
+
+// Function to convert a waitpid status into a shell exit status
+int status_from_wait(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 1;
 }
-void execute_pipeline(char ***commands, int num_commands) {
+
+// Function to run the stages of a pipeline, each in its own child. All stages
+// run at the same time; the pipeline's status is that of the last stage.
+int execute_pipeline(Node *stages) {
     int pipe_fds[2];
-    int in_fd = 0;
+    int in_fd = STDIN_FILENO;
+    int status = 0;
+    int num_stages = 0;
+    int stage_index = 0;
+    pid_t pgid = job_group_for(0);  // Every stage joins the first stage's group
+
+    for (Node *stage = stages; stage != NULL; stage = stage->next) {
+        num_stages++;
+    }
+    pid_t *pids = calloc(num_stages, sizeof(pid_t));
+    if (pids == NULL) {
+        perror("calloc failed for pipeline");
+        return 1;
+    }
 
-    for (int i = 0; i < num_commands; i++) {
-        pipe(pipe_fds);
+    for (Node *stage = stages; stage != NULL; stage = stage->next, stage_index++) {
+        int last = (stage->next == NULL);
+        if (!last && pipe(pipe_fds) == -1) {
+            perror("pipe");
+            break;
+        }
 
-        pid_t pid = fork();
+        pid_t pid = fork_job(pgid, job_control && !in_subshell);
         if (pid == -1) {
             perror("Fork failed");
             exit(1);
         } else if (pid == 0) {
-            dup2(in_fd, STDIN_FILENO);
-            if (i < num_commands - 1) {
+            if (in_fd != STDIN_FILENO) {
+                dup2(in_fd, STDIN_FILENO);
+                close(in_fd);
+            }
+            if (!last) {
                 dup2(pipe_fds[1], STDOUT_FILENO);
+                close(pipe_fds[1]);
+                close(pipe_fds[0]);
             }
-            close(pipe_fds[0]);
-
-            execvp(commands[i][0], commands[i]);
-            perror("execvp failed");
-            exit(1);
+            if (opt_autoaffinity) {
+                pin_to_nth_cpu(stage_index);  // An explicit @cpus= on the stage still wins
+            }
+            exec_pipeline_stage(stage);
         } else {
-            wait(NULL);  // Wait for the child process to complete
-            close(pipe_fds[1]);
-            in_fd = pipe_fds[0];
+            pids[stage_index] = pid;
+            if (pgid == 0) {
+                pgid = pid;
+            }
+            if (in_fd != STDIN_FILENO) {
+                close(in_fd);
+            }
+            if (!last) {
+                close(pipe_fds[1]);
+                in_fd = pipe_fds[0];
+            }
         }
     }
-}
-
-// Function to tokenize the input
-char **tokenize_input(char *input) {
-    char **tokens = malloc(MAX_ARG_COUNT * sizeof(char *));
-    if (!tokens) {
-        perror("malloc failed for tokens");
-        return NULL;
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);  // Only left open if a pipe() failed part way
     }
 
-    char *token;
-    int position = 0;
+    // Wait for every stage that was started
+    status = wait_for_foreground(pids, num_stages, job_label(stages));
+    free(pids);
+    return status;
+}
 
-    token = strtok(input, " ");
-    while (token != NULL) {
-        tokens[position] = token;
-        position++;
-        
-        // Check for array bounds
-        if (position >= MAX_ARG_COUNT - 1) {
-            fprintf(stderr, "Error: Too many arguments\n");
-            break;
+// Function to run one pipeline stage inside its forked child (never returns).
+// Builtins run right here; external commands replace the child with execvp.
+void exec_pipeline_stage(Node *stage) {
+    if (stage->type == NODE_SIMPLE && !is_assignment_only(stage)) {
+        ArgList list = {0};
+        expand_command_words(stage, &list);
+        if (list.count == 0) {
+            _exit(0);
         }
+        arglist_push(&list, NULL);
 
-        token = strtok(NULL, " ");
+        ChildSetup setup;
+        int start = parse_command_prefixes(list.items, &setup);
+        if (start < 0) {
+            _exit(2);
+        }
+        if (setup.timeout_ms > 0) {
+            // Someone has to keep the clock: this child waits with a deadline
+            child_setup = &setup;
+            _exit(execute_external_command(list.items + start, 0));
+        }
+        if (apply_child_setup(&setup) == -1) {
+            _exit(126);
+        }
+        exec_args_in_child(list.items + start);
     }
-    tokens[position] = NULL; // Null-terminate the array
 
-    return tokens;
+    int status = exec_node(stage);
+    out_flush_all();
+    _exit(status);
 }
 
-// Function to determine if the command is built-in or external
-void execute_command(char *input) {
-    int background = 0;
-    int out_fd = STDOUT_FILENO;
-
-    // Check if command ends with '&' for background execution
-    if (input[strlen(input) - 1] == '&') {
-        background = 1;
-        input[strlen(input) - 1] = '\0';  // Remove '&' from input
+// Function to run an expanded command inside a forked child (never returns):
+// builtins run in the child, anything else replaces it via execvp
+void exec_args_in_child(char **args) {
+    if (args[0] == NULL) {
+        _exit(0);
     }
-
-    // Tokenize input
-    char **args = tokenize_input(input);
-    if (args == NULL || args[0] == NULL) {
-        fprintf(stderr, "No command found to execute\n");
-        free(args);
-        return;
+    if (apply_redirections(args, NULL) == -1) {
+        _exit(1);
     }
-
-    // If the command is built-in, execute it and avoid calling external command
+    builtin_status = 0;
     if (handle_builtin_commands(args)) {
-        free(args); // Free args if it's a built-in command
-        return;
+        out_flush_all();
+        _exit(builtin_status);
     }
+    execvp(args[0], args);
+    int exec_errno = errno;
+    perror("execvp");
+    _exit(exec_errno == ENOENT ? 127 : 126);
+}
 
-    // Handle redirection and execute external commands
-    for (int i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], ">") == 0 || strcmp(args[i], ">>") == 0) {
-            int flags = (strcmp(args[i], ">>") == 0) ? (O_WRONLY | O_CREAT | O_APPEND) : (O_WRONLY | O_CREAT | O_TRUNC);
-            if (args[i + 1] == NULL) {
-                fprintf(stderr, "No file specified for redirection\n");
-                free(args);
-                return;
-            }
-            out_fd = open(args[i + 1], flags, 0644);
-            if (out_fd == -1) {
-                perror("Failed to open output file");
-                free(args);
-                return;
-            }
-            args[i] = NULL;  // Remove redirection operators from arguments
-            break;
-        }
-    }
+//============================================parser++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Input is split into tokens, then parsed into a tree of Nodes that exec_node walks.
+// Words keep their quotes so expansion (done per execution) knows what was quoted.
 
-    // Execute external command if not built-in
-    pid_t pid = fork();
-    if (pid == 0) {  // Child process
-        if (out_fd != STDOUT_FILENO) {
-            dup2(out_fd, STDOUT_FILENO);  // Redirect output to file
-            close(out_fd);
-        }
-        execvp(args[0], args);  // Execute the command
-        perror("execvp failed");
-        exit(EXIT_FAILURE);
-    } else if (pid > 0) {  // Parent process
-        if (!background) {
-            waitpid(pid, NULL, 0);
-        } else {
-            printf("Background job started: %d\n", pid);
-        }
-    } else {
-        perror("fork failed");
-    }
+// Function to check whether a character ends an unquoted word
+static int is_word_break(char c) {
+    return c == '\0' || c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+           c == ';' || c == '&' || c == '|' || c == '<' || c == '>';
+}
 
-    if (out_fd != STDOUT_FILENO) {
-        close(out_fd);
+// Function to measure a redirection operator at s: [N]<, [N]>, [N]>>, [N]>&M.
+// Returns 0 when s does not start with one.
+static size_t redirect_length(const char *s) {
+    size_t len = 0;
+    while (isdigit((unsigned char)s[len])) {
+        len++;
     }
-        if (!handle_builtin_commands(args)) {
-        // If not built-in, try to execute it as an external command
-        execute_external_command(args, background);
+    if (s[len] == '<') {
+        return len + 1;
     }
-
-    free(args);
+    if (s[len] != '>') {
+        return 0;
+    }
+    len++;
+    if (s[len] == '>') {
+        len++;
+    } else if (s[len] == '&' && isdigit((unsigned char)s[len + 1])) {
+        len++;
+        while (isdigit((unsigned char)s[len])) {
+            len++;
+        }
+    }
+    return len;
 }
-// Function to handle built-in commands (returns 1 if command is built-in, 0 otherwise)
-int handle_builtin_commands(char **args) {
 
-    if (strcmp(args[0], "pwd") == 0) {
-        quash_pwd();
-        return 1;
-    } else if (strcmp(args[0], "echo") == 0) {
-        quash_echo(args);
-        return 1;
-    } else if (strcmp(args[0], "cd") == 0) {
-        quash_cd(args);
-        return 1;
-    } else if (strcmp(args[0], "exit") == 0) {
-        exit(0); // Direct exit from shell
-    } else if (strcmp(args[0], "jobs") == 0) {
-        print_jobs();
-        return 1;
-    } else if (strcmp(args[0], "export") == 0) {
-        if (args[1] != NULL) {
-            export_variable(args[1]);
-        } else {
-            printf("Usage: export VAR=VALUE\n");
+// Function to append a token to a growable token array
+static void push_token(Token **toks, int *count, int *capacity, TokenType type, char *text) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 32;
+        *toks = realloc(*toks, *capacity * sizeof(Token));
+        if (*toks == NULL) {
+            perror("realloc failed for tokens");
+            exit(1);
         }
-        return 1;
-    
-    } else if (strcmp(args[0], "grep") == 0) {
-        handle_grep(args);  // Call handle_grep for 'grep' command
-        return 1;
     }
-    else if (strcmp(args[0], "cat") == 0) {
-        handle_cat(args);  // Call handle_grep for 'grep' command
-        return 1;
+    (*toks)[*count].type = type;
+    (*toks)[*count].text = text;
+    (*count)++;
+}
+
+// Function to free a token array and any word text still owned by it
+static void free_tokens(Token *toks, int count) {
+    for (int i = 0; i < count; i++) {
+        free(toks[i].text);
     }
-    else if (strcmp(args[0], "kill") == 0) {
-         return handle_kill_command(args);
-    
+    free(toks);
+}
+
+// Function to split input into words and operators (returns 1 on an unterminated quote)
+static int lex_input(const char *src, Token **out, int *out_count) {
+    Token *toks = NULL;
+    int count = 0, capacity = 0;
+    size_t i = 0;
 
-       /*if (args[1] != NULL) {
-            int pid = atoi(args[1]);  // Convert the argument to an integer PID
-            if (pid > 0) {
-                kill_job_by_pid(pid);
+    while (src[i] != '\0') {
+        char c = src[i];
+
+        if (c == ' ' || c == '\t' || c == '\r') {
+            i++;
+        } else if (c == '\\' && src[i + 1] == '\n') {
+            i += 2;  // Line continuation
+        } else if (c == '#') {
+            while (src[i] != '\0' && src[i] != '\n') {
+                i++;  // Comment runs to the end of the line
+            }
+        } else if (c == '\n') {
+            push_token(&toks, &count, &capacity, TOK_NEWLINE, NULL);
+            i++;
+        } else if (c == ';') {
+            push_token(&toks, &count, &capacity, TOK_SEMI, NULL);
+            i++;
+        } else if (c == '&') {
+            if (src[i + 1] == '&') {
+                push_token(&toks, &count, &capacity, TOK_AND_IF, NULL);
+                i += 2;
             } else {
-                printf("Invalid PID: %s\n", args[1]);
+                push_token(&toks, &count, &capacity, TOK_AMP, NULL);
+                i++;
             }
+        } else if (c == '|') {
+            if (src[i + 1] == '|') {
+                push_token(&toks, &count, &capacity, TOK_OR_IF, NULL);
+                i += 2;
+            } else {
+                push_token(&toks, &count, &capacity, TOK_PIPE, NULL);
+                i++;
+            }
+        } else if (c == '<' || c == '>' || redirect_length(src + i) > 0) {
+            // Redirections stay in argv as separate words; commands handle them
+            size_t len = redirect_length(src + i);
+            push_token(&toks, &count, &capacity, TOK_WORD, strndup(src + i, len));
+            i += len;
         } else {
-            printf("Usage: kill <PID>\n");
+            size_t start = i;
+            while (!is_word_break(src[i])) {
+                if (src[i] == '\\') {
+                    if (src[i + 1] == '\0') {
+                        free_tokens(toks, count);
+                        return 1;
+                    }
+                    i += 2;
+                } else if (src[i] == '\'') {
+                    const char *close = strchr(src + i + 1, '\'');
+                    if (close == NULL) {
+                        free_tokens(toks, count);
+                        return 1;
+                    }
+                    i = close - src + 1;
+                } else if (src[i] == '"') {
+                    i++;
+                    while (src[i] != '\0' && src[i] != '"') {
+                        if (src[i] == '\\' && src[i + 1] != '\0') {
+                            i++;
+                        }
+                        i++;
+                    }
+                    if (src[i] == '\0') {
+                        free_tokens(toks, count);
+                        return 1;
+                    }
+                    i++;
+                } else {
+                    i++;
+                }
+            }
+            push_token(&toks, &count, &capacity, TOK_WORD, strndup(src + start, i - start));
         }
-        return 1;*/
     }
+    push_token(&toks, &count, &capacity, TOK_EOF, NULL);
 
-    return 0; // Not a built-in command
+    *out = toks;
+    *out_count = count;
+    return 0;
 }
 
-
-// Built-in function to handle 'pwd' command
-void quash_pwd() {
-    char cwd[1024];
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        printf("%s\n", cwd);
-    } else {
-        perror("getcwd() error");
+// Function to allocate an empty node
+static Node *new_node(NodeType type) {
+    Node *node = calloc(1, sizeof(Node));
+    if (node == NULL) {
+        perror("calloc failed for node");
+        exit(1);
     }
+    node->type = type;
+    return node;
 }
 
+// Function to free a node and everything below it (but not its siblings)
+void free_node(Node *node) {
+    if (node == NULL) {
+        return;
+    }
+    for (int i = 0; i < node->word_count; i++) {
+        free(node->words[i]);
+    }
+    free(node->words);
+    free(node->name);
+    Node *child = node->body;
+    while (child != NULL) {
+        Node *next = child->next;
+        free_node(child);
+        child = next;
+    }
+    free_node(node->cond);
+    free_node(node->else_part);
+    free_node(node->left);
+    free_node(node->right);
+    free(node);
+}
 
-// Helper function to check for environment variables
-char* handle_env_variables(char* arg) {
-    if (arg[0] == '$') {
-        // Skip the '$' and try to get the environment variable value
-        char* value = getenv(arg + 1);
-        if (value) {
-            return value;  // Return the environment variable's value
-        } else {
-            return "";  // If the environment variable is not found, return an empty string
+// Function to copy a node and everything below it (but not its siblings)
+Node *copy_node(Node *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    Node *copy = new_node(node->type);
+    if (node->words != NULL) {
+        copy->words = malloc((node->word_count + 1) * sizeof(char *));
+        if (copy->words == NULL) {
+            perror("malloc failed for words");
+            exit(1);
         }
+        for (int i = 0; i < node->word_count; i++) {
+            copy->words[i] = strdup(node->words[i]);
+        }
+        copy->words[node->word_count] = NULL;
+        copy->word_count = node->word_count;
+    }
+    copy->name = node->name != NULL ? strdup(node->name) : NULL;
+    Node **tail = &copy->body;
+    for (Node *child = node->body; child != NULL; child = child->next) {
+        *tail = copy_node(child);
+        tail = &(*tail)->next;
     }
-    return arg;  // If it's not an environment variable, return the original argument
+    copy->cond = copy_node(node->cond);
+    copy->else_part = copy_node(node->else_part);
+    copy->left = copy_node(node->left);
+    copy->right = copy_node(node->right);
+    copy->background = node->background;
+    copy->negate = node->negate;
+    return copy;
 }
 
-// Helper function to remove surrounding quotes (both ' and ")
-char* remove_quotes(char* arg) {
-    size_t len = strlen(arg);
-    if ((arg[0] == '\'' && arg[len - 1] == '\'') || (arg[0] == '\"' && arg[len - 1] == '\"')) {
-        // Remove the first and last character (quotes)
-        arg[len - 1] = '\0';  // Remove the closing quote
-        return arg + 1;  // Skip the opening quote
-    }
-    return arg;  // Return the argument unchanged if no quotes are found
+static Token *peek(Parser *p) {
+    return &p->toks[p->pos];
 }
 
-// Built-in function to handle 'echo' command with $ENV handling and quote removal
-void quash_echo(char **args) {
-    int out_fd = STDOUT_FILENO;
-    int arg_idx = 1;
+// Function to check whether the next token is the given reserved word
+static int at_keyword(Parser *p, const char *keyword) {
+    Token *t = peek(p);
+    return t->type == TOK_WORD && strcmp(t->text, keyword) == 0;
+}
 
-    // Check for output redirection (">" or ">>")
-    while (args[arg_idx] != NULL) {
-        if (strcmp(args[arg_idx], ">") == 0) {
-            // Output redirection in overwrite mode
-            out_fd = open(args[arg_idx + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (out_fd == -1) {
-                perror("Failed to open output file");
-                return;
-            }
-            args[arg_idx] = NULL;  // Nullify '>' so it's not printed
-            break;
-        } else if (strcmp(args[arg_idx], ">>") == 0) {
-            // Output redirection in append mode
-            out_fd = open(args[arg_idx + 1], O_WRONLY | O_CREAT | O_APPEND, 0644);
-            if (out_fd == -1) {
-                perror("Failed to open output file");
-                return;
-            }
-            args[arg_idx] = NULL;  // Nullify '>>' so it's not printed
-            break;
+// Function to check the next token against a NULL-terminated keyword list
+static int at_any_keyword(Parser *p, const char **keywords) {
+    for (int i = 0; keywords != NULL && keywords[i] != NULL; i++) {
+        if (at_keyword(p, keywords[i])) {
+            return 1;
         }
-        arg_idx++;
     }
+    return 0;
+}
 
-    // Redirect stdout if necessary
-    int saved_stdout = -1;
-    if (out_fd != STDOUT_FILENO) {
-        saved_stdout = dup(STDOUT_FILENO);  // Save current stdout
-        dup2(out_fd, STDOUT_FILENO);        // Redirect stdout to the file
+static int is_reserved_word(const char *word) {
+    static const char *reserved[] = {
+        "for", "while", "until", "if", "then", "elif", "else", "fi", "do", "done", "}", NULL
+    };
+    for (int i = 0; reserved[i] != NULL; i++) {
+        if (strcmp(word, reserved[i]) == 0) {
+            return 1;
+        }
     }
+    return 0;
+}
 
-    // Print each argument after handling environment variables and removing quotes
-    for (int i = 1; args[i] != NULL; i++) {
-        // Handle environment variables (e.g., $PWD)
-        char *processed_arg = handle_env_variables(args[i]);
+// Function to check whether a word is a valid variable name
+int is_valid_name(const char *name, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (!(isalnum((unsigned char)name[i]) || name[i] == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-        // Remove surrounding quotes
-        processed_arg = remove_quotes(processed_arg);
+// Function to report a syntax error at the current token (or note that input ran out)
+static void syntax_error(Parser *p) {
+    static const char *labels[] = { "word", "newline", ";", "&", "|", "&&", "||", "end of file" };
+    if (p->error || p->incomplete) {
+        return;
+    }
+    Token *t = peek(p);
+    if (t->type == TOK_EOF) {
+        p->incomplete = 1;
+        return;
+    }
+    fprintf(stderr, "quash: syntax error near '%s'\n", t->type == TOK_WORD ? t->text : labels[t->type]);
+    p->error = 1;
+}
 
-        // Print the processed argument
-        printf("%s", processed_arg);
-        if (args[i + 1] != NULL) {
-            printf(" ");  // Add space between arguments
-        }
+static void skip_newlines(Parser *p) {
+    while (peek(p)->type == TOK_NEWLINE) {
+        p->pos++;
     }
-    printf("\n");
+}
 
-    // Restore stdout if it was redirected
-    if (out_fd != STDOUT_FILENO) {
-        dup2(saved_stdout, STDOUT_FILENO);  // Restore original stdout
-        close(out_fd);                      // Close the file descriptor
-        close(saved_stdout);                // Close saved stdout descriptor
+// Function to consume a required reserved word
+static int expect_keyword(Parser *p, const char *keyword) {
+    if (at_keyword(p, keyword)) {
+        p->pos++;
+        return 1;
     }
+    syntax_error(p);
+    return 0;
 }
 
+static Node *parse_list(Parser *p, const char **stops);
+static Node *parse_command(Parser *p);
 
-// Built-in function to handle 'cd' command
-void quash_cd(char **args) {
-    if (args[1] == NULL || strcmp(args[1], "~") == 0) {
-        char *home = getenv("HOME");
-        if (home == NULL) {
-            fprintf(stderr, "HOME not set\n");
-        } else if (chdir(home) != 0) {
-            perror("chdir");
-        }
-    } else if (strcmp(args[1], "..") == 0) {
-        if (chdir("..") != 0) {
-            perror("chdir");
-        }
-    } else {
-        if (chdir(args[1]) != 0) {
-            perror("chdir");
-        }
+// Function to parse a list that must contain at least one command (loop/if bodies)
+static Node *parse_compound_list(Parser *p, const char **stops) {
+    Node *list = parse_list(p, stops);
+    if (list != NULL && list->body == NULL) {
+        syntax_error(p);
+        free_node(list);
+        return NULL;
     }
+    return list;
 }
 
-// Function to execute external commands
-void execute_external_command(char **args, int background) {
-    pid_t pid = fork();
-    
-    if (pid == 0) {  // Child process
-        if (execvp(args[0], args) == -1) {
-            perror("execvp");
-        }
-        exit(EXIT_FAILURE);
-    } else if (pid < 0) {
-        perror("fork failed");
+// Function to parse: pipeline { '|' pipeline-stage }
+static Node *parse_pipeline(Parser *p) {
+    int negate = 0;
+    if (at_keyword(p, "!")) {
+        negate = 1;
+        p->pos++;
+    }
+
+    Node *first = parse_command(p);
+    if (first == NULL) {
+        return NULL;
+    }
+    if (peek(p)->type != TOK_PIPE && !negate) {
+        return first;  // A lone command needs no pipeline node
+    }
+
+    Node *pipeline = new_node(NODE_PIPELINE);
+    pipeline->negate = negate;
+    pipeline->body = first;
+    Node *tail = first;
+    while (peek(p)->type == TOK_PIPE) {
+        p->pos++;
+        skip_newlines(p);
+        Node *stage = parse_command(p);
+        if (stage == NULL) {
+            free_node(pipeline);
+            return NULL;
+        }
+        tail->next = stage;
+        tail = stage;
+    }
+    return pipeline;
+}
+
+// Function to parse: pipeline { ('&&' | '||') pipeline }
+static Node *parse_and_or(Parser *p) {
+    Node *left = parse_pipeline(p);
+    if (left == NULL) {
+        return NULL;
+    }
+
+    while (peek(p)->type == TOK_AND_IF || peek(p)->type == TOK_OR_IF) {
+        NodeType type = (peek(p)->type == TOK_AND_IF) ? NODE_AND : NODE_OR;
+        p->pos++;
+        skip_newlines(p);
+        Node *right = parse_pipeline(p);
+        if (right == NULL) {
+            free_node(left);
+            return NULL;
+        }
+        Node *node = new_node(type);
+        node->left = left;
+        node->right = right;
+        left = node;
+    }
+    return left;
+}
+
+// Function to parse commands separated by ';', '&' or newlines until a stop keyword
+static Node *parse_list(Parser *p, const char **stops) {
+    Node *list = new_node(NODE_LIST);
+    Node **tail = &list->body;
+
+    while (1) {
+        skip_newlines(p);
+        if (peek(p)->type == TOK_EOF || at_any_keyword(p, stops)) {
+            break;
+        }
+
+        Node *item = parse_and_or(p);
+        if (item == NULL) {
+            free_node(list);
+            return NULL;
+        }
+        *tail = item;
+        tail = &item->next;
+
+        TokenType type = peek(p)->type;
+        if (type == TOK_SEMI || type == TOK_NEWLINE) {
+            p->pos++;
+        } else if (type == TOK_AMP) {
+            item->background = 1;
+            p->pos++;
+        } else {
+            break;
+        }
+    }
+    return list;
+}
+
+// Function to parse: for NAME [in WORD...] ; do LIST done
+static Node *parse_for(Parser *p) {
+    Node *node = new_node(NODE_FOR);
+    p->pos++;
+
+    Token *t = peek(p);
+    if (t->type != TOK_WORD || !is_valid_name(t->text, strlen(t->text))) {
+        syntax_error(p);
+        free_node(node);
+        return NULL;
+    }
+    node->name = t->text;
+    t->text = NULL;
+    p->pos++;
+    skip_newlines(p);
+
+    if (at_keyword(p, "in")) {
+        p->pos++;
+        int start = p->pos;
+        while (peek(p)->type == TOK_WORD) {
+            p->pos++;
+        }
+        node->word_count = p->pos - start;
+        node->words = malloc((node->word_count + 1) * sizeof(char *));
+        for (int i = 0; i < node->word_count; i++) {
+            node->words[i] = p->toks[start + i].text;
+            p->toks[start + i].text = NULL;
+        }
+        node->words[node->word_count] = NULL;
+
+        if (peek(p)->type != TOK_SEMI && peek(p)->type != TOK_NEWLINE) {
+            syntax_error(p);
+            free_node(node);
+            return NULL;
+        }
+        p->pos++;
+    } else if (peek(p)->type == TOK_SEMI) {
+        p->pos++;
+    }
+    skip_newlines(p);
+
+    static const char *done_stop[] = { "done", NULL };
+    if (!expect_keyword(p, "do") ||
+        (node->body = parse_compound_list(p, done_stop)) == NULL ||
+        !expect_keyword(p, "done")) {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+// Function to parse: while|until LIST ; do LIST done
+static Node *parse_while(Parser *p, NodeType type) {
+    static const char *do_stop[] = { "do", NULL };
+    static const char *done_stop[] = { "done", NULL };
+    Node *node = new_node(type);
+    p->pos++;
+
+    if ((node->cond = parse_compound_list(p, do_stop)) == NULL ||
+        !expect_keyword(p, "do") ||
+        (node->body = parse_compound_list(p, done_stop)) == NULL ||
+        !expect_keyword(p, "done")) {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+// Function to parse: if LIST then LIST [elif ...] [else LIST] fi
+static Node *parse_if(Parser *p) {
+    static const char *then_stop[] = { "then", NULL };
+    static const char *branch_stop[] = { "elif", "else", "fi", NULL };
+    static const char *fi_stop[] = { "fi", NULL };
+    Node *node = new_node(NODE_IF);
+    p->pos++;  // 'if' or 'elif'
+
+    if ((node->cond = parse_compound_list(p, then_stop)) == NULL ||
+        !expect_keyword(p, "then") ||
+        (node->body = parse_compound_list(p, branch_stop)) == NULL) {
+        free_node(node);
+        return NULL;
+    }
+
+    if (at_keyword(p, "elif")) {
+        // An elif chain is a nested if that consumes the shared 'fi'
+        if ((node->else_part = parse_if(p)) == NULL) {
+            free_node(node);
+            return NULL;
+        }
+        return node;
+    }
+    if (at_keyword(p, "else")) {
+        p->pos++;
+        if ((node->else_part = parse_compound_list(p, fi_stop)) == NULL) {
+            free_node(node);
+            return NULL;
+        }
+    }
+    if (!expect_keyword(p, "fi")) {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+// Function to check whether a function definition starts here: 'NAME()' or 'NAME ()'
+static int at_function_definition(Parser *p) {
+    const char *word = peek(p)->text;
+    size_t len = strlen(word);
+    if (len > 2 && strcmp(word + len - 2, "()") == 0) {
+        return is_valid_name(word, len - 2);
+    }
+    Token *next = &p->toks[p->pos + 1];
+    return is_valid_name(word, len) && next->type == TOK_WORD && strcmp(next->text, "()") == 0;
+}
+
+// Function to parse: { LIST }
+static Node *parse_group(Parser *p) {
+    static const char *brace_stop[] = { "}", NULL };
+    Node *list;
+
+    if (!expect_keyword(p, "{") ||
+        (list = parse_compound_list(p, brace_stop)) == NULL) {
+        return NULL;
+    }
+    if (!expect_keyword(p, "}")) {
+        free_node(list);
+        return NULL;
+    }
+    return list;
+}
+
+// Function to parse: NAME() { LIST } or function NAME [()] { LIST }
+static Node *parse_function(Parser *p) {
+    Node *node = new_node(NODE_FUNCTION);
+    if (at_keyword(p, "function")) {
+        p->pos++;
+    }
+
+    Token *t = peek(p);
+    size_t len = t->type == TOK_WORD ? strlen(t->text) : 0;
+    if (len > 2 && strcmp(t->text + len - 2, "()") == 0) {
+        len -= 2;
+    }
+    if (!is_valid_name(t->text, len)) {
+        syntax_error(p);
+        free_node(node);
+        return NULL;
+    }
+    node->name = strndup(t->text, len);
+    p->pos++;
+    if (at_keyword(p, "()")) {
+        p->pos++;
+    }
+    skip_newlines(p);
+
+    if ((node->body = parse_group(p)) == NULL) {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+// Function to parse a single command: a compound command or a list of words
+static Node *parse_command(Parser *p) {
+    Token *t = peek(p);
+    if (t->type != TOK_WORD) {
+        syntax_error(p);
+        return NULL;
+    }
+
+    if (strcmp(t->text, "function") == 0 || at_function_definition(p)) {
+        return parse_function(p);
+    } else if (strcmp(t->text, "{") == 0) {
+        return parse_group(p);
+    } else if (strcmp(t->text, "for") == 0) {
+        return parse_for(p);
+    } else if (strcmp(t->text, "while") == 0) {
+        return parse_while(p, NODE_WHILE);
+    } else if (strcmp(t->text, "until") == 0) {
+        return parse_while(p, NODE_UNTIL);
+    } else if (strcmp(t->text, "if") == 0) {
+        return parse_if(p);
+    } else if (is_reserved_word(t->text)) {
+        syntax_error(p);
+        return NULL;
+    }
+
+    int start = p->pos;
+    while (peek(p)->type == TOK_WORD) {
+        p->pos++;
+    }
+
+    Node *node = new_node(NODE_SIMPLE);
+    node->word_count = p->pos - start;
+    node->words = malloc((node->word_count + 1) * sizeof(char *));
+    for (int i = 0; i < node->word_count; i++) {
+        node->words[i] = p->toks[start + i].text;  // Take ownership of the text
+        p->toks[start + i].text = NULL;
+    }
+    node->words[node->word_count] = NULL;
+    return node;
+}
+
+// Function to parse a complete input. Returns NULL on a syntax error, or with
+// *incomplete set when more input is needed to finish a construct.
+Node *parse_input(const char *src, int *incomplete) {
+    Token *toks;
+    int count;
+
+    *incomplete = 0;
+    if (lex_input(src, &toks, &count) != 0) {
+        *incomplete = 1;
+        return NULL;
+    }
+
+    Parser p = { toks, 0, 0, 0 };
+    Node *tree = parse_list(&p, NULL);
+    if (tree != NULL && peek(&p)->type != TOK_EOF) {
+        syntax_error(&p);
+    }
+    if (p.error || p.incomplete) {
+        free_node(tree);
+        tree = NULL;
+    }
+    *incomplete = p.incomplete;
+    free_tokens(toks, count);
+    return tree;
+}
+
+//============================================parse cache++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Scripts and loops keep executing the same text. Trees are cached by source text
+// (FNV-1a hash, LRU eviction) so only word expansion runs again on a hit.
+
+static uint64_t hash_source(const char *src) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char *c = (const unsigned char *)src; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void lru_unlink(CacheEntry *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(CacheEntry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->lru_prev = entry;
+    }
+    lru_head = entry;
+    if (lru_tail == NULL) {
+        lru_tail = entry;
+    }
+}
+
+static void free_cache_entry(CacheEntry *entry) {
+    free_node(entry->tree);
+    free(entry->source);
+    free(entry);
+}
+
+// Function to take an entry out of the cache; it is freed once nobody holds it
+static void cache_remove(CacheEntry *entry) {
+    CacheEntry **link = &parse_cache[entry->hash & (PARSE_CACHE_BUCKETS - 1)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    lru_unlink(entry);
+    entry->cached = 0;
+    parse_cache_size--;
+    if (entry->refs == 0) {
+        free_cache_entry(entry);
+    }
+}
+
+// Function to get the parsed tree for src, parsing only on a cache miss. The
+// caller owns a reference and must hand it back with release_parsed().
+// Returns NULL on a syntax error or when more input is needed (*incomplete).
+CacheEntry *parse_cached(const char *src, int *incomplete) {
+    uint64_t hash = hash_source(src);
+    CacheEntry **bucket = &parse_cache[hash & (PARSE_CACHE_BUCKETS - 1)];
+
+    *incomplete = 0;
+    for (CacheEntry *entry = *bucket; entry != NULL; entry = entry->hash_next) {
+        if (entry->hash == hash && strcmp(entry->source, src) == 0) {
+            parse_cache_hits++;
+            lru_unlink(entry);
+            lru_push_front(entry);
+            entry->refs++;
+            return entry;
+        }
+    }
+
+    Node *tree = parse_input(src, incomplete);
+    if (tree == NULL) {
+        return NULL;  // Errors and partial input are not worth caching
+    }
+    parse_cache_misses++;
+
+    CacheEntry *entry = calloc(1, sizeof(CacheEntry));
+    char *source = strdup(src);
+    if (entry == NULL || source == NULL) {
+        perror("malloc failed for parse cache");
+        free(entry);
+        free(source);
+        free_node(tree);
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->source = source;
+    entry->tree = tree;
+    entry->refs = 1;
+    entry->cached = 1;
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    lru_push_front(entry);
+    parse_cache_size++;
+
+    while (parse_cache_size > PARSE_CACHE_CAPACITY) {
+        parse_cache_evictions++;
+        cache_remove(lru_tail);
+    }
+    return entry;
+}
+
+// Function to drop a reference obtained from parse_cached()
+void release_parsed(CacheEntry *entry) {
+    entry->refs--;
+    if (entry->refs == 0 && !entry->cached) {
+        free_cache_entry(entry);
+    }
+}
+
+// Built-in function to show parse cache statistics ('cache') or empty it ('cache -c')
+void quash_cache(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "-c") == 0) {
+        while (lru_head != NULL) {
+            cache_remove(lru_head);
+        }
+        return;
+    } else if (args[1] != NULL) {
+        out_printf(STDOUT_FILENO, "Usage: cache [-c]\n");
+        builtin_status = 1;
+        return;
+    }
+
+    unsigned long lookups = parse_cache_hits + parse_cache_misses;
+    out_printf(STDOUT_FILENO, "entries:   %d/%d\n", parse_cache_size, PARSE_CACHE_CAPACITY);
+    out_printf(STDOUT_FILENO, "hits:      %lu\n", parse_cache_hits);
+    out_printf(STDOUT_FILENO, "misses:    %lu\n", parse_cache_misses);
+    out_printf(STDOUT_FILENO, "hit rate:  %.1f%%\n", lookups ? 100.0 * parse_cache_hits / lookups : 0.0);
+    out_printf(STDOUT_FILENO, "evictions: %lu\n", parse_cache_evictions);
+    out_printf(STDOUT_FILENO, "glob dirs: %lu hits, %lu misses\n", dir_cache_hits, dir_cache_misses);
+}
+
+//============================================rc file++++++++++++++++++++++++++++++++++++++++++++++++++++
+// At startup quash runs $QUASHRC (default ~/.quashrc) unless started with --norc.
+// Parsing a large rc on every start adds up when quash is launched thousands of
+// times, so the parsed tree is kept in a snapshot under ~/.cache/quash, keyed by
+// the rc's path, inode, size and mtime. A warm start maps the snapshot with one
+// mmap and points the tree's words straight into the mapping: nothing is parsed
+// or copied. When the rc changes it is parsed again and the snapshot rewritten
+// (temp file + rename, so concurrent shells never see half of one).
+//
+// Snapshot layout: header, rc path, nodes, word table, strings. Children always
+// come after their parent, which keeps a damaged file from forming a cycle.
+
+#define RC_SNAPSHOT_MAGIC "QRCSNAP1"
+#define RC_NO_WORD UINT32_MAX    // Word table entry ending a node's words
+
+typedef struct {
+    char magic[8];
+    uint32_t node_size;       // sizeof(SnapNode), in case the format changes
+    uint32_t path_len;
+    uint64_t rc_dev;
+    uint64_t rc_ino;
+    uint64_t rc_size;
+    int64_t rc_mtime_sec;
+    int64_t rc_mtime_nsec;
+    uint32_t node_count;
+    uint32_t word_count;      // Word table entries, terminators included
+    uint32_t strings_len;
+    int32_t root;
+} RcSnapshotHeader;
+
+typedef struct {
+    int32_t type;
+    int32_t word_count;
+    int32_t first_word;       // Index into the word table, -1 for none
+    int32_t name;             // Offset into the strings, -1 for none
+    int32_t cond;             // Node indices, -1 for none
+    int32_t body;
+    int32_t else_part;
+    int32_t left;
+    int32_t right;
+    int32_t next;
+    int32_t background;
+    int32_t negate;
+} SnapNode;
+
+Node *rc_tree = NULL;          // The rc's tree, kept for the life of the shell
+int rc_running = 0;            // Builtins keep their confirmations to themselves meanwhile
+
+typedef struct {
+    StrBuf nodes;
+    StrBuf words;
+    StrBuf strings;
+    uint32_t node_count;
+    uint32_t word_count;
+} SnapWriter;
+
+static int32_t snap_string(SnapWriter *w, const char *s) {
+    int32_t offset = w->strings.len;
+    strbuf_putn(&w->strings, s, strlen(s) + 1);
+    return offset;
+}
+
+static void snap_word(SnapWriter *w, uint32_t offset) {
+    strbuf_putn(&w->words, (const char *)&offset, sizeof(offset));
+    w->word_count++;
+}
+
+// Function to append node, its siblings and everything below them. Returns its
+// index. Siblings (next) are walked in a loop: an rc is one long list of them.
+static int32_t snap_node(SnapWriter *w, Node *node) {
+    int32_t first = -1;
+    int32_t prev = -1;
+    for (; node != NULL; node = node->next) {
+        SnapNode sn;
+        int32_t index = w->node_count++;
+        memset(&sn, 0, sizeof(sn));
+        strbuf_putn(&w->nodes, (const char *)&sn, sizeof(sn));  // Filled in below
+
+        sn.type = node->type;
+        sn.word_count = node->word_count;
+        sn.first_word = -1;
+        if (node->words != NULL) {
+            sn.first_word = w->word_count;
+            for (int i = 0; i < node->word_count; i++) {
+                snap_word(w, snap_string(w, node->words[i]));
+            }
+            snap_word(w, RC_NO_WORD);
+        }
+        sn.name = node->name ? snap_string(w, node->name) : -1;
+        sn.cond = snap_node(w, node->cond);
+        sn.body = snap_node(w, node->body);
+        sn.else_part = snap_node(w, node->else_part);
+        sn.left = snap_node(w, node->left);
+        sn.right = snap_node(w, node->right);
+        sn.next = -1;  // Set when the next sibling is written
+        sn.background = node->background;
+        sn.negate = node->negate;
+        memcpy(w->nodes.data + index * sizeof(SnapNode), &sn, sizeof(sn));
+
+        if (prev == -1) {
+            first = index;
+        } else {
+            ((SnapNode *)w->nodes.data)[prev].next = index;
+        }
+        prev = index;
+    }
+    return first;
+}
+
+// Function to write the snapshot of tree, parsed from the rc described by st
+static void rc_snapshot_save(const char *snap_path, const char *rc_path, const struct stat *st, Node *tree) {
+    SnapWriter w;
+    RcSnapshotHeader header;
+    memset(&w, 0, sizeof(w));
+    memset(&header, 0, sizeof(header));
+
+    header.root = snap_node(&w, tree);
+    memcpy(header.magic, RC_SNAPSHOT_MAGIC, 8);
+    header.node_size = sizeof(SnapNode);
+    header.path_len = strlen(rc_path);
+    header.rc_dev = st->st_dev;
+    header.rc_ino = st->st_ino;
+    header.rc_size = st->st_size;
+    header.rc_mtime_sec = st->st_mtim.tv_sec;
+    header.rc_mtime_nsec = st->st_mtim.tv_nsec;
+    header.node_count = w.node_count;
+    header.word_count = w.word_count;
+    header.strings_len = w.strings.len;
+
+    // Pad the path so the node array stays aligned
+    StrBuf file = {0};
+    strbuf_putn(&file, (const char *)&header, sizeof(header));
+    strbuf_putn(&file, rc_path, header.path_len);
+    while (file.len % 8 != 0) {
+        strbuf_putn(&file, "", 1);
+    }
+    strbuf_putn(&file, w.nodes.data, w.nodes.len);
+    strbuf_putn(&file, w.words.data, w.words.len);
+    strbuf_putn(&file, w.strings.data, w.strings.len);
+
+    StrBuf tmp = {0};
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d", (int)getpid());
+    strbuf_putn(&tmp, snap_path, strlen(snap_path));
+    strbuf_putn(&tmp, suffix, strlen(suffix));
+    int fd = open(tmp.data, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd != -1) {
+        int ok = (write(fd, file.data, file.len) == (ssize_t)file.len);
+        if (close(fd) == 0 && ok) {
+            rename(tmp.data, snap_path);
+        } else {
+            unlink(tmp.data);
+        }
+    }
+    free(tmp.data);
+    free(file.data);
+    free(w.nodes.data);
+    free(w.words.data);
+    free(w.strings.data);
+}
+
+// Function to map the snapshot if it matches the rc described by st, and rebuild
+// the tree on top of the mapping. Returns NULL if there is no usable snapshot.
+static Node *rc_snapshot_load(const char *snap_path, const char *rc_path, const struct stat *st) {
+    int fd = open(snap_path, O_RDONLY | O_CLOEXEC);
+    struct stat snap_st;
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &snap_st) == -1 || (size_t)snap_st.st_size < sizeof(RcSnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    char *map = mmap(NULL, snap_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const RcSnapshotHeader *header = (const RcSnapshotHeader *)map;
+    size_t path_space = (header->path_len + 7) / 8 * 8;
+    size_t nodes_at = sizeof(RcSnapshotHeader) + path_space;
+    size_t words_at = nodes_at + (size_t)header->node_count * sizeof(SnapNode);
+    size_t strings_at = words_at + (size_t)header->word_count * sizeof(uint32_t);
+    int valid = (memcmp(header->magic, RC_SNAPSHOT_MAGIC, 8) == 0 &&
+                 header->node_size == sizeof(SnapNode) &&
+                 strings_at + header->strings_len == (size_t)snap_st.st_size &&
+                 header->rc_dev == (uint64_t)st->st_dev && header->rc_ino == (uint64_t)st->st_ino &&
+                 header->rc_size == (uint64_t)st->st_size &&
+                 header->rc_mtime_sec == st->st_mtim.tv_sec && header->rc_mtime_nsec == st->st_mtim.tv_nsec &&
+                 header->path_len == strlen(rc_path) &&
+                 memcmp(map + sizeof(RcSnapshotHeader), rc_path, header->path_len) == 0 &&
+                 header->root >= 0 && (uint32_t)header->root < header->node_count &&
+                 header->strings_len > 0 && map[snap_st.st_size - 1] == '\0');
+    if (!valid) {
+        munmap(map, snap_st.st_size);
+        return NULL;
+    }
+
+    const SnapNode *snap = (const SnapNode *)(map + nodes_at);
+    const uint32_t *word_table = (const uint32_t *)(map + words_at);
+    const char *strings = map + strings_at;
+    Node *nodes = calloc(header->node_count, sizeof(Node));
+    char **words = calloc(header->word_count + 1, sizeof(char *));
+    if (nodes == NULL || words == NULL) {
+        free(nodes);
+        free(words);
+        munmap(map, snap_st.st_size);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < header->word_count && valid; i++) {
+        if (word_table[i] == RC_NO_WORD) {
+            words[i] = NULL;
+        } else if (word_table[i] < header->strings_len) {
+            words[i] = (char *)strings + word_table[i];
+        } else {
+            valid = 0;
+        }
+    }
+
+#define SNAP_CHILD(field)                                                              \
+    do {                                                                               \
+        if (sn->field == -1) {                                                         \
+            node->field = NULL;                                                        \
+        } else if (sn->field > (int32_t)i && (uint32_t)sn->field < header->node_count) { \
+            node->field = &nodes[sn->field];                                           \
+        } else {                                                                       \
+            valid = 0;                                                                 \
+        }                                                                              \
+    } while (0)
+
+    for (uint32_t i = 0; i < header->node_count && valid; i++) {
+        const SnapNode *sn = &snap[i];
+        Node *node = &nodes[i];
+        if (sn->type < NODE_SIMPLE || sn->type > NODE_FUNCTION) {
+            valid = 0;
+            break;
+        }
+        node->type = sn->type;
+        node->word_count = sn->word_count;
+        if (sn->first_word >= 0) {
+            if (sn->word_count < 0 || (uint32_t)sn->first_word + sn->word_count >= header->word_count ||
+                word_table[sn->first_word + sn->word_count] != RC_NO_WORD) {
+                valid = 0;
+                break;
+            }
+            node->words = &words[sn->first_word];
+        } else if (sn->word_count != 0) {
+            valid = 0;
+            break;
+        }
+        if (sn->name >= 0 && (uint32_t)sn->name >= header->strings_len) {
+            valid = 0;
+            break;
+        }
+        node->name = sn->name >= 0 ? (char *)strings + sn->name : NULL;
+        SNAP_CHILD(cond);
+        SNAP_CHILD(body);
+        SNAP_CHILD(else_part);
+        SNAP_CHILD(left);
+        SNAP_CHILD(right);
+        SNAP_CHILD(next);
+        node->background = sn->background;
+        node->negate = sn->negate;
+    }
+#undef SNAP_CHILD
+
+    if (!valid) {
+        free(nodes);
+        free(words);
+        munmap(map, snap_st.st_size);
+        return NULL;
+    }
+    return &nodes[header->root];  // Kept, like the mapping, for the life of the shell
+}
+
+// Function to read and parse the rc on fd. Returns NULL (after reporting why) if
+// it can't be parsed.
+static Node *rc_parse(int fd, const char *rc_path) {
+    StrBuf text = {0};
+    char buf[READ_BUF_SIZE];
+    ssize_t n;
+    int incomplete = 0;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        strbuf_putn(&text, buf, n);
+    }
+    strbuf_putn(&text, "", 0);
+    Node *tree = parse_input(text.data, &incomplete);
+    if (incomplete) {
+        fprintf(stderr, "quash: %s: syntax error: unexpected end of file\n", rc_path);
+    }
+    free(text.data);
+    return tree;
+}
+
+// Function to run the rc file, from its snapshot when that is up to date
+void run_rc_file() {
+    const char *rc_path = getenv("QUASHRC");
+    const char *home = getenv("HOME");
+    StrBuf path = {0};
+    StrBuf snap_path = {0};
+
+    if (rc_path == NULL && home != NULL) {
+        strbuf_putn(&path, home, strlen(home));
+        strbuf_putn(&path, "/.quashrc", 9);
+        rc_path = path.data;
+    }
+    if (rc_path == NULL || *rc_path == '\0') {
+        return;  // QUASHRC= turns the rc off
+    }
+    int fd = open(rc_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        free(path.data);
+        return;
+    }
+
+    // $XDG_CACHE_HOME/quash/rc-HASH, HASH being that of the rc path
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home != NULL && *cache_home != '\0') {
+        strbuf_putn(&snap_path, cache_home, strlen(cache_home));
+    } else if (home != NULL) {
+        strbuf_putn(&snap_path, home, strlen(home));
+        strbuf_putn(&snap_path, "/.cache", 7);
+    }
+
+    Node *tree = NULL;
+    if (snap_path.len > 0) {
+        char name[64];
+        snprintf(name, sizeof(name), "/quash/rc-%016llx", (unsigned long long)hash_source(rc_path));
+        strbuf_putn(&snap_path, name, strlen(name));
+        tree = rc_snapshot_load(snap_path.data, rc_path, &st);
+    }
+    if (tree == NULL) {
+        tree = rc_parse(fd, rc_path);
+        if (tree != NULL && snap_path.len > 0) {
+            // Create the cache directories on the way
+            char *slash = strrchr(snap_path.data, '/');
+            *slash = '\0';
+            char *parent = strrchr(snap_path.data, '/');
+            *parent = '\0';
+            mkdir(snap_path.data, 0700);
+            *parent = '/';
+            mkdir(snap_path.data, 0700);
+            *slash = '/';
+            rc_snapshot_save(snap_path.data, rc_path, &st, tree);
+        }
+    }
+    close(fd);
+
+    if (tree != NULL) {
+        rc_tree = tree;
+        rc_running = 1;
+        exec_node(tree);
+        rc_running = 0;
+        out_flush_all();
+    }
+    free(path.data);
+    free(snap_path.data);
+}
+
+//============================================variables and expansion++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Function to look up a variable: shell variables first, then the environment
+const char *lookup_variable(const char *name) {
+    for (ShellVar *var = shell_vars[hash_source(name) & (SHELL_VAR_BUCKETS - 1)]; var != NULL; var = var->next) {
+        if (strcmp(var->name, name) == 0) {
+            return var->value;
+        }
+    }
+    return getenv(name);
+}
+
+// Function to set a shell variable (exported variables stay in the environment)
+void set_shell_variable(const char *name, const char *value) {
+    ShellVar **bucket = &shell_vars[hash_source(name) & (SHELL_VAR_BUCKETS - 1)];
+    if (getenv(name) != NULL) {
+        setenv(name, value, 1);
+        return;
+    }
+    for (ShellVar *var = *bucket; var != NULL; var = var->next) {
+        if (strcmp(var->name, name) == 0) {
+            char *copy = strdup(value);
+            if (copy != NULL) {
+                free(var->value);
+                var->value = copy;
+            }
+            return;
+        }
+    }
+    ShellVar *var = malloc(sizeof(ShellVar));
+    if (var == NULL) {
+        perror("malloc failed for variable");
+        return;
+    }
+    var->name = strdup(name);
+    var->value = strdup(value);
+    var->next = *bucket;
+    *bucket = var;
+}
+
+// Function to drop a shell variable (used when it gets exported)
+void unset_shell_variable(const char *name) {
+    for (ShellVar **link = &shell_vars[hash_source(name) & (SHELL_VAR_BUCKETS - 1)]; *link != NULL;
+         link = &(*link)->next) {
+        if (strcmp((*link)->name, name) == 0) {
+            ShellVar *var = *link;
+            *link = var->next;
+            free(var->name);
+            free(var->value);
+            free(var);
+            return;
+        }
+    }
+}
+
+void strbuf_putn(StrBuf *sb, const char *s, size_t n) {
+    if (sb->len + n + 1 > sb->cap) {
+        size_t cap = sb->cap ? sb->cap : 32;
+        while (cap < sb->len + n + 1) {
+            cap *= 2;
+        }
+        char *grown = realloc(sb->data, cap);
+        if (grown == NULL) {
+            perror("realloc failed for word");
+            exit(1);
+        }
+        sb->data = grown;
+        sb->cap = cap;
+    }
+    memcpy(sb->data + sb->len, s, n);
+    sb->len += n;
+    sb->data[sb->len] = '\0';
+}
+
+static void strbuf_putc(StrBuf *sb, char c) {
+    strbuf_putn(sb, &c, 1);
+}
+
+// Function to append an item to a growable argument list
+void arglist_push(ArgList *list, char *item) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 8;
+        list->items = realloc(list->items, list->capacity * sizeof(char *));
+        if (list->items == NULL) {
+            perror("realloc failed for arguments");
+            exit(1);
+        }
+    }
+    list->items[list->count++] = item;
+}
+
+void arglist_free(ArgList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = list->capacity = 0;
+}
+
+// Function to append text to the field being built. Quoted wildcard characters
+// are escaped in the glob pattern so they only ever match themselves.
+static void field_put(Field *field, const char *s, size_t n, int quoted) {
+    strbuf_putn(&field->text, s, n);
+    for (size_t i = 0; i < n; i++) {
+        int special = (strchr("*?[]\\", s[i]) != NULL && s[i] != '\0');
+        if (quoted && special) {
+            strbuf_putc(&field->pattern, '\\');
+        } else if (!quoted && (s[i] == '*' || s[i] == '?' || s[i] == '[')) {
+            field->glob = 1;
+        }
+        strbuf_putc(&field->pattern, s[i]);
+    }
+    field->have = 1;
+}
+
+// Function to finish the field being built and move it (or its glob matches) into the list
+static void end_field(Field *field, ArgList *out) {
+    if (field->glob && !opt_noglob && glob_expand(field->pattern.data, out) > 0) {
+        free(field->text.data);
+    } else {
+        // No wildcard, or nothing matched: the word stays as written
+        arglist_push(out, field->text.data != NULL ? field->text.data : strdup(""));
+    }
+    free(field->pattern.data);
+    memset(field, 0, sizeof(Field));
+}
+
+// Function to get positional parameter n ($0 is the shell's name), NULL when unset
+static const char *positional_parameter(int n) {
+    if (n == 0) {
+        return "quash";
+    }
+    return n <= positional_count ? positional_args[n - 1] : NULL;
+}
+
+// Function to expand a '$' reference starting at raw[*pos]. Unquoted results
+// are split on whitespace into separate fields when split is set.
+static void expand_dollar(const char *raw, size_t *pos, Field *field, ArgList *out,
+                          int split, int quoted) {
+    char numbuf[32];
+    char name[256];
+    StrBuf joined = {0};
+    const char *value = NULL;
+    size_t j = *pos + 1;
+
+    if (raw[j] == '{' && strchr(raw + j, '}') != NULL) {
+        size_t len = strchr(raw + j, '}') - (raw + j + 1);
+        if (len >= sizeof(name)) {
+            len = sizeof(name) - 1;
+        }
+        memcpy(name, raw + j + 1, len);
+        name[len] = '\0';
+        value = isdigit((unsigned char)name[0]) ? positional_parameter(atoi(name)) : lookup_variable(name);
+        j = strchr(raw + j, '}') - raw + 1;
+    } else if (isdigit((unsigned char)raw[j])) {
+        value = positional_parameter(raw[j] - '0');
+        j++;
+    } else if (raw[j] == '#') {
+        snprintf(numbuf, sizeof(numbuf), "%d", positional_count);
+        value = numbuf;
+        j++;
+    } else if (raw[j] == '@' && quoted) {
+        // "$@" gives each parameter its own field
+        for (int i = 0; i < positional_count; i++) {
+            if (i > 0) {
+                end_field(field, out);
+            }
+            field_put(field, positional_args[i], strlen(positional_args[i]), 1);
+        }
+        *pos = j + 1;
+        return;
+    } else if (raw[j] == '@' || raw[j] == '*') {
+        for (int i = 0; i < positional_count; i++) {
+            if (i > 0) {
+                strbuf_putn(&joined, " ", 1);
+            }
+            strbuf_putn(&joined, positional_args[i], strlen(positional_args[i]));
+        }
+        value = joined.data;
+        j++;
+    } else if (raw[j] == '?') {
+        snprintf(numbuf, sizeof(numbuf), "%d", last_status);
+        value = numbuf;
+        j++;
+    } else if (raw[j] == '$') {
+        snprintf(numbuf, sizeof(numbuf), "%d", (int)getpid());
+        value = numbuf;
+        j++;
+    } else if (isalpha((unsigned char)raw[j]) || raw[j] == '_') {
+        size_t len = 0;
+        while (isalnum((unsigned char)raw[j + len]) || raw[j + len] == '_') {
+            len++;
+        }
+        if (len >= sizeof(name)) {
+            len = sizeof(name) - 1;
+        }
+        memcpy(name, raw + j, len);
+        name[len] = '\0';
+        value = lookup_variable(name);
+        while (isalnum((unsigned char)raw[j]) || raw[j] == '_') {
+            j++;
+        }
+    } else {
+        // A lone '$' is just a character
+        field_put(field, "$", 1, 1);
+        *pos = j;
+        return;
+    }
+    *pos = j;
+
+    if (value == NULL) {
+        value = "";
+    }
+    if (!split) {
+        if (value[0] != '\0' || quoted) {
+            field_put(field, value, strlen(value), quoted);
+        }
+    } else {
+        for (const char *v = value; *v != '\0'; v++) {
+            if (*v == ' ' || *v == '\t' || *v == '\n') {
+                if (field->have) {
+                    end_field(field, out);
+                }
+            } else {
+                field_put(field, v, 1, 0);
+            }
+        }
+    }
+    free(joined.data);
+}
+
+// Function to expand one raw word (quotes, escapes, $VAR, ${VAR}, $?, $$, $1, $@, globs)
+// into zero or more fields appended to out. The raw word itself is never modified.
+void expand_word(const char *raw, ArgList *out, int split) {
+    Field field;
+    size_t i = 0;
+
+    memset(&field, 0, sizeof(Field));
+    while (raw[i] != '\0') {
+        char c = raw[i];
+        if (c == '\\') {
+            if (raw[i + 1] == '\n') {
+                i += 2;
+                continue;
+            }
+            if (raw[i + 1] != '\0') {
+                i++;
+            }
+            field_put(&field, raw + i, 1, 1);
+            i++;
+        } else if (c == '\'') {
+            const char *close = strchr(raw + i + 1, '\'');
+            size_t len = close ? (size_t)(close - (raw + i + 1)) : strlen(raw + i + 1);
+            field_put(&field, raw + i + 1, len, 1);
+            i += len + (close ? 2 : 1);
+        } else if (c == '"') {
+            i++;
+            field.have = 1;
+            while (raw[i] != '\0' && raw[i] != '"') {
+                if (raw[i] == '\\' && raw[i + 1] != '\0' && strchr("$`\"\\\n", raw[i + 1]) != NULL) {
+                    if (raw[i + 1] != '\n') {
+                        field_put(&field, raw + i + 1, 1, 1);
+                    }
+                    i += 2;
+                } else if (raw[i] == '$') {
+                    expand_dollar(raw, &i, &field, out, 0, 1);
+                } else {
+                    field_put(&field, raw + i, 1, 1);
+                    i++;
+                }
+            }
+            if (raw[i] == '"') {
+                i++;
+            }
+        } else if (c == '$') {
+            expand_dollar(raw, &i, &field, out, split, 0);
+        } else {
+            field_put(&field, raw + i, 1, 0);
+            i++;
+        }
+    }
+
+    if (field.have) {
+        // Assignments and other unsplit contexts never glob
+        if (!split) {
+            field.glob = 0;
+        }
+        end_field(&field, out);
+    } else {
+        free(field.text.data);
+        free(field.pattern.data);
+    }
+}
+
+// Function to check whether a raw word has the form NAME=value
+static int is_assignment(const char *word) {
+    const char *eq = strchr(word, '=');
+    return eq != NULL && is_valid_name(word, eq - word);
+}
+
+// Function to check whether a simple command consists only of assignments
+int is_assignment_only(Node *node) {
+    if (node->word_count == 0) {
+        return 0;
+    }
+    for (int i = 0; i < node->word_count; i++) {
+        if (!is_assignment(node->words[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//============================================globbing++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Patterns are compiled once into per-segment opcode lists. Directories are read
+// with getdents64 into flat listings; segments without wildcards are appended to
+// the path without reading anything, and '**' walks subdirectories recursively.
+// With 'set -o globcache' listings are kept and reused while the directory's
+// mtime (and identity) is unchanged.
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Function to compile one path segment of a pattern ("\x" escapes a character)
+static void compile_glob_segment(GlobSegment *seg, const char *src, size_t len) {
+    StrBuf literal = {0};
+    int has_wildcard = 0;
+
+    memset(seg, 0, sizeof(GlobSegment));
+    if (len == 2 && src[0] == '*' && src[1] == '*') {
+        seg->doublestar = 1;
+        return;
+    }
+
+    seg->ops = calloc(len + 1, sizeof(GlobOp));
+    for (size_t i = 0; i < len; i++) {
+        GlobOp *op = &seg->ops[seg->nops];
+        char c = src[i];
+
+        if (c == '\\' && i + 1 < len) {
+            op->type = GLOB_LITERAL;
+            op->ch = src[++i];
+        } else if (c == '?') {
+            op->type = GLOB_ANY;
+            has_wildcard = 1;
+        } else if (c == '*') {
+            if (seg->nops > 0 && seg->ops[seg->nops - 1].type == GLOB_STAR) {
+                continue;  // '**' inside a segment is the same as '*'
+            }
+            op->type = GLOB_STAR;
+            has_wildcard = 1;
+        } else if (c == '[' && memchr(src + i + 1, ']', len - i - 1) != NULL) {
+            size_t j = i + 1;
+            op->type = GLOB_CLASS;
+            if (src[j] == '!' || src[j] == '^') {
+                op->negate = 1;
+                j++;
+            }
+            // A ']' right after the opening bracket is a member, not the end
+            int first = 1;
+            while (j < len && (src[j] != ']' || first)) {
+                unsigned char lo = src[j];
+                if (lo == '\\' && j + 1 < len) {
+                    lo = src[++j];
+                }
+                unsigned char hi = lo;
+                if (j + 2 < len && src[j + 1] == '-' && src[j + 2] != ']') {
+                    hi = src[j + 2];
+                    j += 2;
+                }
+                for (unsigned int ch = lo; ch <= hi; ch++) {
+                    op->bits[ch >> 3] |= 1 << (ch & 7);
+                }
+                j++;
+                first = 0;
+            }
+            if (j >= len) {
+                // Never closed after all: treat '[' as an ordinary character
+                memset(op, 0, sizeof(GlobOp));
+                op->type = GLOB_LITERAL;
+                op->ch = '[';
+            } else {
+                has_wildcard = 1;
+                i = j;
+            }
+        } else {
+            op->type = GLOB_LITERAL;
+            op->ch = c;
+        }
+        if (op->type == GLOB_LITERAL) {
+            strbuf_putc(&literal, op->ch);
+        }
+        seg->nops++;
+    }
+
+    seg->dot_ok = (seg->nops > 0 && seg->ops[0].type == GLOB_LITERAL && seg->ops[0].ch == '.');
+
+    // '*.log' style segments: most names can be rejected by their ending alone
+    int tail = seg->nops;
+    while (tail > 0 && seg->ops[tail - 1].type == GLOB_LITERAL) {
+        tail--;
+    }
+    if (tail > 0 && tail < seg->nops && seg->ops[tail - 1].type == GLOB_STAR) {
+        seg->suffix_len = seg->nops - tail;
+        seg->suffix = malloc(seg->suffix_len);
+        for (size_t k = 0; k < seg->suffix_len; k++) {
+            seg->suffix[k] = seg->ops[tail + k].ch;
+        }
+    }
+
+    if (!has_wildcard) {
+        seg->literal = literal.data != NULL ? literal.data : strdup("");
+    } else {
+        free(literal.data);
+    }
+}
+
+static void free_glob_pattern(GlobPattern *pattern) {
+    if (pattern == NULL) {
+        return;
+    }
+    for (int i = 0; i < pattern->nsegs; i++) {
+        free(pattern->segs[i].ops);
+        free(pattern->segs[i].literal);
+        free(pattern->segs[i].suffix);
+    }
+    free(pattern->segs);
+    free(pattern->source);
+    free(pattern);
+}
+
+// Function to compile a whole pattern, reusing a recent compilation of the same text
+static GlobPattern *compile_glob(const char *src) {
+    static GlobPattern *recent[GLOB_PATTERN_CACHE_SIZE];
+    uint64_t hash = hash_source(src);
+    GlobPattern **slot = &recent[hash % GLOB_PATTERN_CACHE_SIZE];
+
+    if (*slot != NULL && strcmp((*slot)->source, src) == 0) {
+        return *slot;
+    }
+
+    GlobPattern *pattern = calloc(1, sizeof(GlobPattern));
+    pattern->source = strdup(src);
+    pattern->absolute = (src[0] == '/');
+
+    const char *p = src;
+    while (*p == '/') {
+        p++;
+    }
+    int capacity = 1;
+    for (const char *c = p; *c != '\0'; c++) {
+        capacity += (*c == '/');
+    }
+    pattern->segs = calloc(capacity, sizeof(GlobSegment));
+
+    while (*p != '\0') {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len > 0) {
+            compile_glob_segment(&pattern->segs[pattern->nsegs++], p, len);
+        }
+        if (end == NULL) {
+            break;
+        }
+        p = end + 1;
+        if (*p == '\0') {
+            pattern->dirs_only = 1;  // Trailing '/' only matches directories
+        }
+    }
+
+    free_glob_pattern(*slot);
+    *slot = pattern;
+    return pattern;
+}
+
+// Function to test a class op against a character
+static int glob_class_has(const GlobOp *op, unsigned char c) {
+    int member = (op->bits[c >> 3] >> (c & 7)) & 1;
+    return member != op->negate;
+}
+
+// Function to match a name against one compiled segment
+static int glob_match(const GlobSegment *seg, const char *name) {
+    const GlobOp *ops = seg->ops;
+    int n = seg->nops;
+    int pi = 0;
+    int star_pi = -1;
+    const char *s = name;
+    const char *star_s = NULL;
+
+    if (name[0] == '.' && !seg->dot_ok) {
+        return 0;  // Hidden names need an explicit leading '.'
+    }
+    if (seg->suffix != NULL) {
+        size_t len = strlen(name);
+        if (len < seg->suffix_len || memcmp(name + len - seg->suffix_len, seg->suffix, seg->suffix_len) != 0) {
+            return 0;
+        }
+    }
+
+    while (*s != '\0') {
+        if (pi < n && ops[pi].type == GLOB_STAR) {
+            star_pi = pi++;
+            star_s = s;
+            continue;
+        }
+        if (pi < n &&
+            ((ops[pi].type == GLOB_LITERAL && ops[pi].ch == (unsigned char)*s) ||
+             ops[pi].type == GLOB_ANY ||
+             (ops[pi].type == GLOB_CLASS && glob_class_has(&ops[pi], *s)))) {
+            pi++;
+            s++;
+            continue;
+        }
+        if (star_pi < 0) {
+            return 0;
+        }
+        // Let the last '*' swallow one more character and retry
+        pi = star_pi + 1;
+        s = ++star_s;
+    }
+    while (pi < n && ops[pi].type == GLOB_STAR) {
+        pi++;
+    }
+    return pi == n;
+}
+
+static void free_dir_listing(DirListing *listing) {
+    if (listing == NULL) {
+        return;
+    }
+    free(listing->path);
+    free(listing->names);
+    free(listing->offsets);
+    free(listing->types);
+    free(listing);
+}
+
+// Function to read a whole directory with getdents64 into a flat listing.
+// "." and ".." are left out. Returns NULL if the directory can't be opened.
+static DirListing *read_dir_listing(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    DirListing *listing = calloc(1, sizeof(DirListing));
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        listing->dev = st.st_dev;
+        listing->ino = st.st_ino;
+        listing->mtime = st.st_mtim;
+    }
+
+    char *buf = malloc(GETDENTS_BUF_SIZE);
+    size_t names_cap = 0;
+    int entries_cap = 0;
+    long nread;
+    while (buf != NULL && (nread = syscall(SYS_getdents64, fd, buf, GETDENTS_BUF_SIZE)) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+
+            size_t len = strlen(d->d_name) + 1;
+            if (listing->names_len + len > names_cap) {
+                names_cap = names_cap ? names_cap * 2 : 4096;
+                while (names_cap < listing->names_len + len) {
+                    names_cap *= 2;
+                }
+                listing->names = realloc(listing->names, names_cap);
+            }
+            if (listing->count == entries_cap) {
+                entries_cap = entries_cap ? entries_cap * 2 : 128;
+                listing->offsets = realloc(listing->offsets, entries_cap * sizeof(int));
+                listing->types = realloc(listing->types, entries_cap);
+            }
+            memcpy(listing->names + listing->names_len, d->d_name, len);
+            listing->offsets[listing->count] = listing->names_len;
+            listing->types[listing->count] = d->d_type;
+            listing->names_len += len;
+            listing->count++;
+        }
+    }
+    free(buf);
+    close(fd);
+
+    listing->path = strdup(path);
+    return listing;
+}
+
+// Function to look a directory up in a cache of size listings, rereading it when
+// it changed. *hit is 1 for a cache hit, 0 for a reread, -1 if it can't be read.
+DirListing *cached_dir_listing(DirListing **cache, int size, int *next_slot, const char *path, int *hit) {
+    struct stat st;
+    *hit = -1;
+    if (stat(path, &st) == -1) {
+        return NULL;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < size; i++) {
+        DirListing *cached = cache[i];
+        if (cached != NULL && strcmp(cached->path, path) == 0) {
+            // Valid while it is the same directory and nothing was added or removed.
+            // A listing taken in the same second as the last change may have
+            // raced with it, so it is not trusted.
+            if (cached->dev == st.st_dev && cached->ino == st.st_ino &&
+                cached->mtime.tv_sec == st.st_mtim.tv_sec &&
+                cached->mtime.tv_nsec == st.st_mtim.tv_nsec && !cached->racy) {
+                *hit = 1;
+                return cached;
+            }
+            slot = i;
+            break;
+        }
+    }
+    *hit = 0;
+
+    DirListing *listing = read_dir_listing(path);
+    if (listing == NULL) {
+        return NULL;
+    }
+    listing->racy = (time(NULL) <= listing->mtime.tv_sec + 1);
+
+    if (slot == -1) {
+        slot = *next_slot;
+        *next_slot = (*next_slot + 1) % size;
+    }
+    free_dir_listing(cache[slot]);
+    cache[slot] = listing;
+    return listing;
+}
+
+// Function to get the listing of a directory. With the glob cache enabled the
+// listing is shared (*owned = 0); otherwise the caller must free it (*owned = 1).
+DirListing *get_dir_listing(const char *path, int *owned) {
+    static int next_slot = 0;
+    int hit;
+
+    if (!opt_globcache) {
+        *owned = 1;
+        return read_dir_listing(path);
+    }
+    *owned = 0;
+
+    DirListing *listing = cached_dir_listing(dir_cache, GLOB_DIR_CACHE_SIZE, &next_slot, path, &hit);
+    if (hit == 1) {
+        dir_cache_hits++;
+    } else if (hit == 0) {
+        dir_cache_misses++;
+    }
+    return listing;
+}
+
+// Function to drop every cached directory listing
+void clear_dir_cache() {
+    for (int i = 0; i < GLOB_DIR_CACHE_SIZE; i++) {
+        free_dir_listing(dir_cache[i]);
+        dir_cache[i] = NULL;
+    }
+}
+
+// Function to check whether entry i of a listing is a directory (following symlinks)
+static int listing_is_dir(DirListing *listing, int i, const char *full_path) {
+    unsigned char type = listing->types[i];
+    if (type == DT_DIR) {
+        return 1;
+    }
+    if (type == DT_LNK || type == DT_UNKNOWN) {
+        struct stat st;
+        return stat(full_path, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    return 0;
+}
+
+// Function to check the type of a listing entry without following symlinks ('**' walk)
+static int listing_is_real_dir(DirListing *listing, int i, const char *full_path) {
+    unsigned char type = listing->types[i];
+    if (type == DT_UNKNOWN) {
+        struct stat st;
+        return lstat(full_path, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    return type == DT_DIR;
+}
+
+static void glob_walk(GlobPattern *pattern, int seg_index, StrBuf *path, ArgList *out);
+
+// Function to add a matched path (checking the trailing-'/' rule)
+static void glob_add_match(GlobPattern *pattern, StrBuf *path, ArgList *out, int known_dir) {
+    if (path->len == 0) {
+        return;
+    }
+    if (pattern->dirs_only) {
+        struct stat st;
+        if (!known_dir && (stat(path->data, &st) == -1 || !S_ISDIR(st.st_mode))) {
+            return;
+        }
+        char *match = malloc(path->len + 2);
+        memcpy(match, path->data, path->len);
+        strcpy(match + path->len, "/");
+        arglist_push(out, match);
+        return;
+    }
+    arglist_push(out, strdup(path->data));
+}
+
+// Function to append "/name" (or just "name" at the start of a relative path)
+static size_t glob_path_push(StrBuf *path, const char *name) {
+    size_t saved = path->len;
+    if (path->len > 0 && path->data[path->len - 1] != '/') {
+        strbuf_putc(path, '/');
+    }
+    strbuf_putn(path, name, strlen(name));
+    return saved;
+}
+
+static void glob_path_pop(StrBuf *path, size_t saved) {
+    path->len = saved;
+    if (path->data != NULL) {
+        path->data[saved] = '\0';
+    }
+}
+
+// Function to expand '**': zero or more directory levels (never through symlinks)
+static void glob_walk_doublestar(GlobPattern *pattern, int seg_index, StrBuf *path, ArgList *out) {
+    int last = (seg_index == pattern->nsegs - 1);
+    int owned;
+    DirListing *listing = get_dir_listing(path->len ? path->data : ".", &owned);
+
+    // Zero directories: let the rest of the pattern match right here
+    if (!last) {
+        glob_walk(pattern, seg_index + 1, path, out);
+    }
+    if (listing == NULL) {
+        return;
+    }
+
+    // Copy the names out first: recursion may replace cached listings
+    int count = listing->count;
+    char **names = malloc(count * sizeof(char *) + 1);
+    unsigned char *types = malloc(count + 1);
+    for (int i = 0; i < count; i++) {
+        names[i] = strdup(listing->names + listing->offsets[i]);
+        types[i] = listing->types[i];
+    }
+    DirListing view = { .types = types };
+    if (owned) {
+        free_dir_listing(listing);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (names[i][0] != '.') {
+            size_t saved = glob_path_push(path, names[i]);
+            int is_dir = listing_is_real_dir(&view, i, path->data);
+            if (last) {
+                glob_add_match(pattern, path, out, is_dir);  // Trailing '**' matches everything below
+            }
+            if (is_dir) {
+                glob_walk_doublestar(pattern, seg_index, path, out);
+            }
+            glob_path_pop(path, saved);
+        }
+        free(names[i]);
+    }
+    free(names);
+    free(types);
+}
+
+// Function to match pattern segments from seg_index on, below path
+static void glob_walk(GlobPattern *pattern, int seg_index, StrBuf *path, ArgList *out) {
+    if (seg_index == pattern->nsegs) {
+        glob_add_match(pattern, path, out, 0);
+        return;
+    }
+
+    GlobSegment *seg = &pattern->segs[seg_index];
+    int last = (seg_index == pattern->nsegs - 1);
+
+    if (seg->doublestar) {
+        glob_walk_doublestar(pattern, seg_index, path, out);
+        return;
+    }
+
+    if (seg->literal != NULL) {
+        // No wildcard in this segment: no need to read the directory at all
+        size_t saved = glob_path_push(path, seg->literal);
+        struct stat st;
+        if (!last) {
+            glob_walk(pattern, seg_index + 1, path, out);
+        } else if (lstat(path->data, &st) == 0) {
+            glob_add_match(pattern, path, out, S_ISDIR(st.st_mode));
+        }
+        glob_path_pop(path, saved);
+        return;
+    }
+
+    int owned;
+    DirListing *listing = get_dir_listing(path->len ? path->data : ".", &owned);
+    if (listing == NULL) {
+        return;
+    }
+
+    // Collect matches first: deeper levels may replace cached listings
+    ArgList matched = {0};
+    for (int i = 0; i < listing->count; i++) {
+        const char *name = listing->names + listing->offsets[i];
+        if (glob_match(seg, name)) {
+            size_t saved = glob_path_push(path, name);
+            if (last) {
+                glob_add_match(pattern, path, out, listing->types[i] == DT_DIR);
+            } else if (listing_is_dir(listing, i, path->data)) {
+                arglist_push(&matched, strdup(name));
+            }
+            glob_path_pop(path, saved);
+        }
+    }
+    if (owned) {
+        free_dir_listing(listing);
+    }
+
+    for (int i = 0; i < matched.count; i++) {
+        size_t saved = glob_path_push(path, matched.items[i]);
+        glob_walk(pattern, seg_index + 1, path, out);
+        glob_path_pop(path, saved);
+    }
+    arglist_free(&matched);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// Function to expand a glob pattern into sorted matching paths appended to out.
+// Returns the number of matches.
+int glob_expand(const char *pattern_text, ArgList *out) {
+    GlobPattern *pattern = compile_glob(pattern_text);
+    StrBuf path = {0};
+    int first = out->count;
+
+    if (pattern->absolute) {
+        strbuf_putc(&path, '/');
+    }
+    glob_walk(pattern, 0, &path, out);
+    free(path.data);
+
+    qsort(out->items + first, out->count - first, sizeof(char *), compare_strings);
+    return out->count - first;
+}
+
+//============================================shell options++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Built-in function to handle 'set -o NAME', 'set +o NAME' and 'set -o' (list)
+void quash_set(char **args) {
+    if (args[1] == NULL || (args[2] == NULL && strcmp(args[1], "-o") == 0)) {
+        for (int i = 0; shell_options[i].name != NULL; i++) {
+            out_printf(STDOUT_FILENO, "%-12s %s\n", shell_options[i].name, *shell_options[i].value ? "on" : "off");
+        }
+        for (int i = 0; duration_options[i].name != NULL; i++) {
+            char text[32] = "off";
+            if (*duration_options[i].value > 0) {
+                format_duration(*duration_options[i].value, text, sizeof(text));
+            }
+            out_printf(STDOUT_FILENO, "%-12s %s\n", duration_options[i].name, text);
+        }
+        return;
+    }
+
+    for (int i = 1; args[i] != NULL; i++) {
+        int enable;
+        if (strcmp(args[i], "-o") == 0) {
+            enable = 1;
+        } else if (strcmp(args[i], "+o") == 0) {
+            enable = 0;
+        } else if (strcmp(args[i], "-f") == 0 || strcmp(args[i], "+f") == 0) {
+            opt_noglob = (args[i][0] == '-');
+            continue;
+        } else {
+            fprintf(stderr, "set: %s: invalid option\n", args[i]);
+            builtin_status = 2;
+            return;
+        }
+
+        const char *name = args[++i];
+        if (name == NULL) {
+            fprintf(stderr, "set: option name required\n");
+            builtin_status = 2;
+            return;
+        }
+        int found = 0;
+        const char *eq = strchr(name, '=');
+        size_t name_len = eq ? (size_t)(eq - name) : strlen(name);
+        for (int j = 0; duration_options[j].name != NULL; j++) {
+            if (strlen(duration_options[j].name) == name_len && strncmp(duration_options[j].name, name, name_len) == 0) {
+                long ms = 0;
+                if (enable && (eq == NULL || parse_duration(eq + 1, &ms) == -1)) {
+                    fprintf(stderr, "set: %s: expected %.*s=DURATION\n", name, (int)name_len, name);
+                    builtin_status = 2;
+                    return;
+                }
+                *duration_options[j].value = ms;
+                found = 1;
+            }
+        }
+        for (int j = 0; shell_options[j].name != NULL; j++) {
+            if (strcmp(shell_options[j].name, name) == 0) {
+                *shell_options[j].value = enable;
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "set: %s: invalid option name\n", name);
+            builtin_status = 2;
+            return;
+        }
+        if (strcmp(name, "globcache") == 0 && !enable) {
+            clear_dir_cache();
+        }
+    }
+}
+
+//============================================affinity and resource limits++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Commands can carry '@key=value' prefixes, or be run through 'limit key=value...'
+// or 'taskset -c LIST'. The settings are applied in the child between fork and
+// execvp, so nothing extra is spawned and the shell itself is unaffected.
+
+// Which suffixes a limit value may carry
+typedef enum {
+    LIMIT_COUNT,    // Plain number
+    LIMIT_SIZE,     // K/M/G/T, optionally followed by B
+    LIMIT_SECONDS   // s/m/h
+} LimitKind;
+
+// Resource names accepted by 'limit' and '@key=value'
+static const struct {
+    const char *name;
+    int resource;
+    LimitKind kind;
+} limit_names[] = {
+    { "mem", RLIMIT_AS, LIMIT_SIZE },
+    { "cpu", RLIMIT_CPU, LIMIT_SECONDS },
+    { "nofile", RLIMIT_NOFILE, LIMIT_COUNT },
+    { "nproc", RLIMIT_NPROC, LIMIT_COUNT },
+    { "fsize", RLIMIT_FSIZE, LIMIT_SIZE },
+    { "stack", RLIMIT_STACK, LIMIT_SIZE },
+    { "core", RLIMIT_CORE, LIMIT_SIZE },
+    { NULL, 0, 0 }
+};
+
+// Function to parse a CPU list such as "0-3,8,10-11"
+int parse_cpu_list(const char *text, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = text;
+    while (*p != '\0') {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p || lo < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo) {
+                return -1;
+            }
+        }
+        if (hi >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long cpu = lo; cpu <= hi; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+// Function to parse a limit value: a number with the suffixes kind allows, or
+// "unlimited". Values too large for rlim_t are rejected rather than wrapped.
+int parse_limit_value(const char *text, LimitKind kind, rlim_t *value) {
+    if (strcmp(text, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (end == text || errno != 0) {
+        return -1;
+    }
+    unsigned long long scale = 1;
+    if (kind == LIMIT_SIZE) {
+        switch (toupper((unsigned char)*end)) {
+        case 'K': scale = 1ULL << 10; end++; break;
+        case 'M': scale = 1ULL << 20; end++; break;
+        case 'G': scale = 1ULL << 30; end++; break;
+        case 'T': scale = 1ULL << 40; end++; break;
+        }
+        if (*end == 'B' || *end == 'b') {
+            end++;
+        }
+    } else if (kind == LIMIT_SECONDS) {
+        switch (*end) {
+        case 's': end++; break;
+        case 'm': scale = 60; end++; break;
+        case 'h': scale = 3600; end++; break;
+        }
+    }
+    // RLIM_INFINITY itself is only reachable by spelling out "unlimited"
+    if (*end != '\0' || n > (RLIM_INFINITY - 1) / scale) {
+        return -1;
+    }
+    *value = (rlim_t)(n * scale);
+    return 0;
+}
+
+// Function to record one key=value setting (cpus, nice or a resource limit)
+static int add_setup_setting(ChildSetup *setup, const char *setting) {
+    const char *eq = strchr(setting, '=');
+    if (eq == NULL) {
+        return -1;
+    }
+    size_t key_len = eq - setting;
+    const char *value = eq + 1;
+
+    if (key_len == 4 && strncmp(setting, "cpus", 4) == 0) {
+        if (parse_cpu_list(value, &setup->cpus) == -1) {
+            return -1;
+        }
+        setup->has_cpus = 1;
+        return 0;
+    }
+    if (key_len == 4 && strncmp(setting, "nice", 4) == 0) {
+        char *end;
+        long n = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || n < -20 || n > 19) {
+            return -1;
+        }
+        setup->has_nice = 1;
+        setup->nice = (int)n;
+        return 0;
+    }
+    for (int i = 0; limit_names[i].name != NULL; i++) {
+        if (strlen(limit_names[i].name) == key_len && strncmp(setting, limit_names[i].name, key_len) == 0) {
+            if (setup->nlimits == MAX_CHILD_LIMITS) {
+                return -1;
+            }
+            rlim_t limit;
+            if (parse_limit_value(value, limit_names[i].kind, &limit) == -1) {
+                return -1;
+            }
+            setup->limits[setup->nlimits].resource = limit_names[i].resource;
+            setup->limits[setup->nlimits].value = limit;
+            setup->nlimits++;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Function to strip leading '@key=value', 'limit key=value...' and 'taskset -c LIST'
+// prefixes from args into setup. Returns the index of the real command, or -1
+// after reporting a malformed prefix.
+int parse_command_prefixes(char **args, ChildSetup *setup) {
+    int i = 0;
+
+    memset(setup, 0, sizeof(ChildSetup));
+    while (args[i] != NULL) {
+        if (args[i][0] == '@' && strchr(args[i], '=') != NULL) {
+            if (add_setup_setting(setup, args[i] + 1) == -1) {
+                fprintf(stderr, "quash: invalid prefix: %s\n", args[i]);
+                return -1;
+            }
+            i++;
+        } else if (strcmp(args[i], "limit") == 0) {
+            i++;
+            while (args[i] != NULL && strchr(args[i], '=') != NULL) {
+                if (add_setup_setting(setup, args[i]) == -1) {
+                    fprintf(stderr, "limit: invalid setting: %s\n", args[i]);
+                    return -1;
+                }
+                i++;
+            }
+            if (args[i] == NULL) {
+                fprintf(stderr, "Usage: limit KEY=VALUE... COMMAND [ARGS]\n");
+                return -1;
+            }
+        } else if (strcmp(args[i], "taskset") == 0 && args[i + 1] != NULL &&
+                   strcmp(args[i + 1], "-c") == 0 && args[i + 2] != NULL &&
+                   args[i + 3] != NULL && strcmp(args[i + 3], "-p") != 0) {
+            if (parse_cpu_list(args[i + 2], &setup->cpus) == -1) {
+                fprintf(stderr, "taskset: invalid cpu list: %s\n", args[i + 2]);
+                return -1;
+            }
+            setup->has_cpus = 1;
+            i += 3;
+        } else if (strcmp(args[i], "timeout") == 0) {
+            // timeout [-s SIGNAL] [-k GRACE] DURATION COMMAND
+            setup->timeout_signal = SIGTERM;
+            setup->grace_ms = opt_kill_grace_ms;
+            i++;
+            while (args[i] != NULL && args[i + 1] != NULL &&
+                   (strcmp(args[i], "-s") == 0 || strcmp(args[i], "-k") == 0)) {
+                if (args[i][1] == 's' && (setup->timeout_signal = parse_signal(args[i + 1])) == -1) {
+                    fprintf(stderr, "timeout: invalid signal: %s\n", args[i + 1]);
+                    return -1;
+                }
+                if (args[i][1] == 'k' && parse_duration(args[i + 1], &setup->grace_ms) == -1) {
+                    fprintf(stderr, "timeout: invalid duration: %s\n", args[i + 1]);
+                    return -1;
+                }
+                i += 2;
+            }
+            if (args[i] == NULL || parse_duration(args[i], &setup->timeout_ms) == -1 || args[i + 1] == NULL) {
+                fprintf(stderr, "Usage: timeout [-s SIGNAL] [-k GRACE] DURATION COMMAND [ARGS]\n");
+                return -1;
+            }
+            if (setup->timeout_ms == 0) {
+                setup->timeout_ms = -1;  // 'timeout 0' means no limit
+            }
+            i++;
+        } else {
+            break;
+        }
+    }
+    if (i > 0 && args[i] == NULL) {
+        fprintf(stderr, "quash: %s: command expected after prefix\n", args[i - 1]);
+        return -1;
+    }
+    return i;
+}
+
+// Function to apply affinity, priority and limits to the calling process (a child)
+int apply_child_setup(const ChildSetup *setup) {
+    if (setup == NULL) {
+        return 0;
+    }
+    if (setup->has_cpus && sched_setaffinity(0, sizeof(cpu_set_t), &setup->cpus) == -1) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    if (setup->has_nice && setpriority(PRIO_PROCESS, 0, setup->nice) == -1) {
+        perror("setpriority");
+        return -1;
+    }
+    for (int i = 0; i < setup->nlimits; i++) {
+        struct rlimit rl;
+        rl.rlim_cur = setup->limits[i].value;
+        rl.rlim_max = setup->limits[i].value;
+        if (setrlimit(setup->limits[i].resource, &rl) == -1) {
+            perror("setrlimit");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Function to pin the calling process to the n-th CPU the shell may run on
+// ('set -o autoaffinity' spreads pipeline stages this way)
+void pin_to_nth_cpu(int n) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == -1) {
+        return;
+    }
+    int count = CPU_COUNT(&allowed);
+    if (count <= 1) {
+        return;
+    }
+    int wanted = n % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && wanted-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            sched_setaffinity(0, sizeof(cpu_set_t), &one);
+            return;
+        }
+    }
+}
+
+// Function to print a cpu set as a compact list ("0-3,6")
+static void print_cpu_list(const cpu_set_t *set) {
+    int first = 1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set)) {
+            continue;
+        }
+        int end = cpu;
+        while (end + 1 < CPU_SETSIZE && CPU_ISSET(end + 1, set)) {
+            end++;
+        }
+        out_printf(STDOUT_FILENO, first ? "%d" : ",%d", cpu);
+        if (end > cpu) {
+            out_printf(STDOUT_FILENO, "-%d", end);
+        }
+        first = 0;
+        cpu = end;
+    }
+    out_printf(STDOUT_FILENO, "\n");
+}
+
+// Built-in function to handle 'taskset [-c LIST] -p PID' and plain 'taskset'.
+// ('taskset -c LIST CMD...' is handled as a command prefix.)
+void quash_taskset(char **args) {
+    cpu_set_t set;
+    pid_t pid = 0;
+    const char *list = NULL;
+
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-c") == 0 && args[i + 1] != NULL) {
+            list = args[++i];
+        } else if (strcmp(args[i], "-p") == 0 && args[i + 1] != NULL) {
+            pid = atoi(args[++i]);
+        } else {
+            out_printf(STDOUT_FILENO, "Usage: taskset -c LIST COMMAND [ARGS] | taskset [-c LIST] -p PID\n");
+            builtin_status = 1;
+            return;
+        }
+    }
+
+    if (list != NULL) {
+        if (parse_cpu_list(list, &set) == -1) {
+            fprintf(stderr, "taskset: invalid cpu list: %s\n", list);
+            builtin_status = 1;
+            return;
+        }
+        if (sched_setaffinity(pid, sizeof(cpu_set_t), &set) == -1) {
+            perror("taskset");
+            builtin_status = 1;
+            return;
+        }
+    }
+    if (sched_getaffinity(pid, sizeof(cpu_set_t), &set) == -1) {
+        perror("taskset");
+        builtin_status = 1;
+        return;
+    }
+    out_printf(STDOUT_FILENO, "pid %d's affinity list: ", pid ? pid : getpid());
+    print_cpu_list(&set);
+}
+
+// Built-in function to handle 'ulimit [-S|-H] [-a|-c|-f|-n|-s|-t|-u|-v] [VALUE]'.
+// Limits set here apply to the shell and everything it starts afterwards.
+void quash_ulimit(char **args) {
+    static const struct {
+        char flag;
+        int resource;
+        rlim_t unit;
+        LimitKind kind;  // Sizes are counted in kbytes here, so they take no suffix
+        const char *label;
+    } table[] = {
+        { 'c', RLIMIT_CORE, 1024, LIMIT_COUNT, "core file size (kbytes)" },
+        { 'f', RLIMIT_FSIZE, 1024, LIMIT_COUNT, "file size (kbytes)" },
+        { 'n', RLIMIT_NOFILE, 1, LIMIT_COUNT, "open files" },
+        { 's', RLIMIT_STACK, 1024, LIMIT_COUNT, "stack size (kbytes)" },
+        { 't', RLIMIT_CPU, 1, LIMIT_SECONDS, "cpu time (seconds)" },
+        { 'u', RLIMIT_NPROC, 1, LIMIT_COUNT, "max user processes" },
+        { 'v', RLIMIT_AS, 1024, LIMIT_COUNT, "virtual memory (kbytes)" },
+        { 0, 0, 0, 0, NULL }
+    };
+    int soft = 1, hard = 1, show_all = 0;
+    int which = 1;  // -f by default, like other shells
+    const char *value = NULL;
+
+    for (int i = 1; args[i] != NULL; i++) {
+        if (args[i][0] != '-' || args[i][1] == '\0') {
+            value = args[i];
+            continue;
+        }
+        for (const char *f = args[i] + 1; *f != '\0'; f++) {
+            if (*f == 'S') {
+                soft = 1;
+                hard = 0;
+            } else if (*f == 'H') {
+                hard = 1;
+                soft = 0;
+            } else if (*f == 'a') {
+                show_all = 1;
+            } else {
+                int found = -1;
+                for (int t = 0; table[t].label != NULL; t++) {
+                    if (table[t].flag == *f) {
+                        found = t;
+                    }
+                }
+                if (found == -1) {
+                    fprintf(stderr, "ulimit: -%c: invalid option\n", *f);
+                    builtin_status = 2;
+                    return;
+                }
+                which = found;
+            }
+        }
+    }
+
+    for (int t = 0; table[t].label != NULL; t++) {
+        if (!show_all && t != which) {
+            continue;
+        }
+        struct rlimit rl;
+        if (getrlimit(table[t].resource, &rl) == -1) {
+            perror("ulimit");
+            builtin_status = 1;
+            return;
+        }
+
+        if (value != NULL && !show_all) {
+            rlim_t limit;
+            if (parse_limit_value(value, table[t].kind, &limit) == -1 ||
+                (limit != RLIM_INFINITY && limit > (RLIM_INFINITY - 1) / table[t].unit)) {
+                fprintf(stderr, "ulimit: %s: invalid number\n", value);
+                builtin_status = 1;
+                return;
+            }
+            if (limit != RLIM_INFINITY) {
+                limit *= table[t].unit;
+            }
+            if (soft) {
+                rl.rlim_cur = limit;
+            }
+            if (hard) {
+                rl.rlim_max = limit;
+            }
+            if (setrlimit(table[t].resource, &rl) == -1) {
+                perror("ulimit");
+                builtin_status = 1;
+            }
+            return;
+        }
+
+        rlim_t shown = hard && !soft ? rl.rlim_max : rl.rlim_cur;
+        if (show_all) {
+            out_printf(STDOUT_FILENO, "%-28s (-%c) ", table[t].label, table[t].flag);
+        }
+        if (shown == RLIM_INFINITY) {
+            out_printf(STDOUT_FILENO, "unlimited\n");
+        } else {
+            out_printf(STDOUT_FILENO, "%llu\n", (unsigned long long)(shown / table[t].unit));
+        }
+    }
+}
+
+//============================================event loop++++++++++++++++++++++++++++++++++++++++++++++++++++
+// A single poll() loop runs whenever the shell would otherwise block: waiting for
+// input, for a foreground child, or while following a job's output. Sources
+// register an fd and a handler. SIGCHLD is turned into a readable fd with a
+// self-pipe so waits for children wake up here too.
+
+// Function to put an fd into non-blocking, close-on-exec mode
+void set_nonblocking_cloexec(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void drain_sigchld_pipe(int fd, void *ctx) {
+    char buf[64];
+    (void)ctx;
+    while (read(fd, buf, sizeof(buf)) > 0) {
+        // Only the wake-up matters
+    }
+}
+
+// Function to register a handler called when fd becomes readable
+void event_add(int fd, EventHandler handler, void *ctx) {
+    if (event_count == event_capacity) {
+        event_capacity = event_capacity ? event_capacity * 2 : 16;
+        event_sources = realloc(event_sources, event_capacity * sizeof(EventSource));
+        if (event_sources == NULL) {
+            perror("realloc failed for event sources");
+            exit(1);
+        }
+    }
+    event_sources[event_count].fd = fd;
+    event_sources[event_count].handler = handler;
+    event_sources[event_count].on_writable = NULL;
+    event_sources[event_count].ctx = ctx;
+    event_count++;
+}
+
+// Function to unregister fd (safe to call from inside its own handler)
+void event_remove(int fd) {
+    for (int i = 0; i < event_count; i++) {
+        if (event_sources[i].fd == fd) {
+            event_sources[i] = event_sources[--event_count];
+            return;
+        }
+    }
+}
+
+// Function to also call handler whenever a registered fd becomes writable
+// (NULL stops watching for that)
+void event_want_write(int fd, EventHandler handler) {
+    for (int i = 0; i < event_count; i++) {
+        if (event_sources[i].fd == fd) {
+            event_sources[i].on_writable = handler;
+            return;
+        }
+    }
+}
+
+// Function to set up the SIGCHLD self-pipe and handler
+void init_event_loop() {
+    if (pipe(sigchld_pipe) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    set_nonblocking_cloexec(sigchld_pipe[0]);
+    set_nonblocking_cloexec(sigchld_pipe[1]);
+    event_add(sigchld_pipe[0], drain_sigchld_pipe, NULL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;  // Stopped children wake us up too
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+// Function to give a freshly forked child its own event state. Sources belong
+// to the parent, and sharing the SIGCHLD pipe would steal the parent's wake-ups.
+// A subshell that needs the loop again sets up a fresh one on first use.
+void reset_child_events() {
+    signal(SIGCHLD, SIG_DFL);
+    if (job_control) {
+        // Undo what init_job_control ignored
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        job_control = 0;
+    }
+    if (daemon_pid != 0) {
+        // Undo the daemon's shutdown handlers (see run_daemon)
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+    }
+    in_subshell = 1;
+    interrupted = 0;
+    for (int i = 0; i < event_count; i++) {
+        close(event_sources[i].fd);
+    }
+    if (sigchld_pipe[1] != -1) {
+        close(sigchld_pipe[1]);
+    }
+    sigchld_pipe[0] = sigchld_pipe[1] = -1;
+    event_count = 0;
+    capture_open = 0;
+    reset_child_deadlines();
+}
+
+// Function to wait up to timeout_ms (-1 = forever) for events and run their
+// handlers. Returns 1 if watch_fd (when not -1) became readable.
+int event_loop_once(int timeout_ms, int watch_fd) {
+    struct pollfd stack_fds[32];
+    struct pollfd *fds = stack_fds;
+
+    if (sigchld_pipe[0] == -1) {
+        init_event_loop();
+    }
+    int nfds = event_count + (watch_fd != -1);
+
+    if (nfds > 32) {
+        fds = malloc(nfds * sizeof(struct pollfd));
+        if (fds == NULL) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < event_count; i++) {
+        fds[i].fd = event_sources[i].fd;
+        fds[i].events = POLLIN | (event_sources[i].on_writable != NULL ? POLLOUT : 0);
+        fds[i].revents = 0;
+    }
+    if (watch_fd != -1) {
+        fds[event_count].fd = watch_fd;
+        fds[event_count].events = POLLIN;
+        fds[event_count].revents = 0;
+    }
+
+    int ready = 0;
+    int n = poll(fds, nfds, timeout_ms);
+    if (n > 0) {
+        int count = event_count;
+        for (int i = 0; i < count; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            // Handlers may add or remove sources; look ours up again by fd
+            for (int j = 0; j < event_count; j++) {
+                if (event_sources[j].fd == fds[i].fd) {
+                    if (fds[i].revents & ~POLLOUT) {
+                        event_sources[j].handler(fds[i].fd, event_sources[j].ctx);
+                    }
+                    break;
+                }
+            }
+            for (int j = 0; (fds[i].revents & POLLOUT) && j < event_count; j++) {
+                if (event_sources[j].fd == fds[i].fd) {
+                    if (event_sources[j].on_writable != NULL) {
+                        event_sources[j].on_writable(fds[i].fd, event_sources[j].ctx);
+                    }
+                    break;
+                }
+            }
+        }
+        ready = (watch_fd != -1 && fds[count].revents != 0);
+    } else if (n == -1 && errno != EINTR) {
+        perror("poll");
+    }
+
+    if (fds != stack_fds) {
+        free(fds);
+    }
+    return ready;
+}
+
+// Function to wait for a specific child while keeping the event loop running.
+// Returns the raw waitpid status.
+int wait_for_child(pid_t pid) {
+    int status = 0;
+    while (1) {
+        pid_t result = waitpid(pid, &status, WNOHANG);
+        if (result == pid) {
+            return status;
+        }
+        if (result == -1 && errno != EINTR) {
+            return status;
+        }
+        if (result == 0) {
+            event_loop_once(-1, -1);  // SIGCHLD will wake us up
+        }
+    }
+}
+
+// Function to read one line (with its '\n') into line, servicing the event loop
+// while no input is available. Returns 0 at end of input.
+int read_line(LineReader *reader, StrBuf *line) {
+    line->len = 0;
+    while (1) {
+        char *start = reader->buf + reader->start;
+        size_t avail = reader->end - reader->start;
+        char *newline = memchr(start, '\n', avail);
+        if (newline != NULL) {
+            size_t n = newline - start + 1;
+            strbuf_putn(line, start, n);
+            reader->start += n;
+            return 1;
+        }
+        if (avail > 0) {
+            strbuf_putn(line, start, avail);
+        }
+        reader->start = reader->end = 0;
+        if (reader->eof) {
+            return line->len > 0;
+        }
+
+        while (!event_loop_once(-1, reader->fd)) {
+            // Keep servicing other sources until input arrives
+        }
+        ssize_t n = read(reader->fd, reader->buf, sizeof(reader->buf));
+        if (n > 0) {
+            reader->end = n;
+        } else if (n == 0) {
+            reader->eof = 1;
+        } else if (errno != EINTR && errno != EAGAIN) {
+            perror("Error reading input");
+            reader->eof = 1;
+        }
+    }
+}
+
+//============================================job output capture++++++++++++++++++++++++++++++++++++++++++++++++++++
+// With 'set -o capture', background jobs write stdout and stderr into a pipe
+// instead of the terminal. The event loop drains each pipe into a ring that keeps
+// the last CAPTURE_RING_SIZE bytes, so memory stays bounded and the job never
+// blocks on a full pipe. 'jobs -o %N' shows the ring, 'jobs -f %N' follows it.
+
+// Function to append bytes to a ring, overwriting the oldest data when full.
+// The buffer grows on demand, so quiet jobs cost almost nothing.
+static void ring_write(OutputRing *ring, const char *data, size_t len) {
+    if (ring->total < CAPTURE_RING_SIZE && ring->alloc < CAPTURE_RING_SIZE &&
+        ring->total + len > ring->alloc) {
+        size_t alloc = ring->alloc ? ring->alloc : 4096;
+        while (alloc < ring->total + len && alloc < CAPTURE_RING_SIZE) {
+            alloc *= 2;
+        }
+        if (alloc > CAPTURE_RING_SIZE) {
+            alloc = CAPTURE_RING_SIZE;
+        }
+        char *grown = realloc(ring->data, alloc);
+        if (grown == NULL) {
+            return;
+        }
+        ring->data = grown;
+        ring->alloc = alloc;
+    }
+
+    // Only the tail of a huge write can survive anyway
+    if (len > ring->alloc) {
+        ring->total += len - ring->alloc;
+        data += len - ring->alloc;
+        len = ring->alloc;
+    }
+    size_t pos = ring->total % ring->alloc;
+    size_t first = ring->alloc - pos < len ? ring->alloc - pos : len;
+    memcpy(ring->data + pos, data, first);
+    memcpy(ring->data, data + first, len - first);
+    ring->total += len;
+}
+
+// Function to write ring contents from absolute offset 'from' on to fd.
+// Returns the offset written up to.
+static unsigned long long ring_dump(OutputRing *ring, unsigned long long from, int fd) {
+    unsigned long long oldest = ring->total > ring->alloc ? ring->total - ring->alloc : 0;
+    if (from < oldest) {
+        out_printf(fd, "[... %llu bytes dropped ...]\n", oldest - from);
+        from = oldest;
+    }
+    while (from < ring->total) {
+        size_t pos = from % ring->alloc;
+        size_t n = ring->alloc - pos;
+        if (n > ring->total - from) {
+            n = ring->total - from;
+        }
+        out_write(fd, ring->data + pos, n);
+        from += n;
+    }
+    return from;
+}
+
+// Function to look up a job by id. Ids increase through the table; the daemon
+// drops finished jobs, so the table can have gaps and is binary searched.
+static Job *find_job(int job_id) {
+    int low = 0;
+    int high = job_count - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        if (jobs[mid].job_id == job_id) {
+            return &jobs[mid];
+        }
+        if (jobs[mid].job_id < job_id) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+// Function to move what a captured job has written into its ring. At most one
+// ring's worth is taken per call, so readers of the ring (the daemon streaming
+// to a client) get a chance to catch up before anything is overwritten.
+static void capture_drain(int fd, void *ctx) {
+    Job *job = find_job((int)(intptr_t)ctx);
+    char buf[16384];
+    size_t taken = 0;
+
+    while (taken < CAPTURE_RING_SIZE) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            if (job != NULL) {
+                ring_write(&job->output, buf, n);
+            }
+            taken += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (n == -1 && errno != EAGAIN)) {
+            // Every writer is gone: the job (and anything it started) finished
+            event_remove(fd);
+            close(fd);
+            capture_open--;
+            if (job != NULL) {
+                job->capture_fd = -1;
+            }
+        }
+        return;
+    }
+}
+
+// Function to create the capture pipe for a new background job (-1 if capture is off)
+int capture_begin(int fds[2]) {
+    if (!opt_capture) {
+        return -1;
+    }
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    set_nonblocking_cloexec(fds[0]);
+    return 0;
+}
+
+// Function to point stdout and stderr of the child at the capture pipe
+void capture_child(int fds[2]) {
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[1]);
+    close(fds[0]);
+}
+
+// Function to hand the read end of the capture pipe to the newest job
+void capture_attach(int fds[2]) {
+    close(fds[1]);
+    Job *job = find_job(last_job_id);
+    if (job == NULL) {
+        close(fds[0]);
+        return;
+    }
+    job->captured = 1;
+    job->capture_fd = fds[0];
+    capture_open++;
+    event_add(fds[0], capture_drain, (void *)(intptr_t)job->job_id);
+}
+
+// Function to service capture pipes and deadlines without blocking (used during long builtin runs)
+void capture_poll() {
+    if (capture_open > 0 || deadlines_pending()) {
+        event_loop_once(0, -1);
+    }
+}
+
+// Function to show ('jobs -o %N') or follow ('jobs -f %N') a job's captured output.
+// Following stops when the job's output ends or a line is typed.
+void show_job_output(char *spec, int follow) {
+    Job *job = find_job(spec != NULL && spec[0] == '%' ? atoi(spec + 1) : -1);
+    if (job == NULL) {
+        out_printf(STDOUT_FILENO, "Usage: jobs -o %%JOBID | jobs -f %%JOBID\n");
+        builtin_status = 1;
+        return;
+    }
+    if (!job->captured) {
+        out_printf(STDOUT_FILENO, "Job [%d] output was not captured (set -o capture)\n", job->job_id);
+        builtin_status = 1;
+        return;
+    }
+
+    capture_poll();
+    unsigned long long shown = ring_dump(&job->output, 0, STDOUT_FILENO);
+    out_flush(STDOUT_FILENO);
+
+    while (follow && job->capture_fd != -1) {
+        int job_id = job->job_id;
+        if (event_loop_once(-1, STDIN_FILENO)) {
+            break;  // The user typed something: back to the prompt
+        }
+        job = find_job(job_id);  // The table may have moved
+        shown = ring_dump(&job->output, shown, STDOUT_FILENO);
+        out_flush(STDOUT_FILENO);
+    }
+}
+
+//============================================history++++++++++++++++++++++++++++++++++++++++++++++++++++
+// History is one append-only file ($HISTFILE, default ~/.quash_history), one
+// entry per line with '\n' and '\' escaped. Every shell appends with O_APPEND in a
+// single write(), so concurrent shells interleave whole entries. The file is
+// mapped read-only at startup; nothing is read until history is used.
+//
+// Substring search goes through a trigram index in HISTFILE.idx: for every
+// trigram, the sorted offsets of the entries containing it. The index records
+// how many bytes of history it covers. Entries after that (written since, by any
+// shell) are indexed into an in-memory delta on first use, and the merged index
+// is written back at exit. The history file is never rescanned as a whole.
+// The index names the file it was built from (inode) and fingerprints the
+// covered bytes, so a history file that was replaced or truncated and written
+// again is indexed from scratch. The index is private (0600) like the file.
+
+#define HISTORY_INDEX_MAGIC "QHIDX02\n"
+#define HISTORY_FINGERPRINT_SPAN 256
+
+typedef struct {
+    char magic[8];
+    uint64_t covered;         // Bytes of the history file indexed
+    uint64_t inode;           // History file the index was built from
+    uint64_t fingerprint;     // Hash of the start and end of the covered bytes
+    uint64_t term_count;
+    uint64_t posting_count;
+} HistIndexHeader;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t first;           // Position of its first posting
+} HistIndexTerm;
+
+// Postings of one trigram for entries after the on-disk index
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t *offsets;        // NULL marks an empty hash slot
+} HistDeltaTerm;
+
+typedef struct {
+    int fd;                   // History file, opened with O_APPEND
+    char *path;
+    const char *map;          // Read-only mapping of the history file
+    size_t map_len;
+    char *last_added;         // Last entry this shell wrote (skip repeats)
+    pid_t owner;              // Only the shell that built the delta saves it
+
+    int index_loaded;
+    void *index_map;          // Mapping of the on-disk index, if any
+    size_t index_len;
+    const HistIndexTerm *terms;
+    uint64_t term_count;
+    const uint64_t *postings;
+    uint64_t base_covered;    // Bytes covered by the on-disk index
+    uint64_t covered;         // ... and by the delta
+    uint64_t fingerprint;     // history_fingerprint() of the covered bytes
+    uint64_t inode;
+
+    HistDeltaTerm *delta;     // Open-addressing hash keyed by trigram
+    size_t delta_capacity;
+    size_t delta_terms;
+    size_t delta_postings;
+} History;
+
+History history = { .fd = -1 };
+
+// Function to pick the delta hash slot of a trigram
+static size_t delta_slot(uint32_t trigram) {
+    uint32_t h = trigram * 2654435761u;
+    return (h ^ (h >> 15)) & (history.delta_capacity - 1);
+}
+
+static uint32_t make_trigram(const char *s) {
+    return ((uint32_t)(unsigned char)s[0] << 16) | ((uint32_t)(unsigned char)s[1] << 8) | (unsigned char)s[2];
+}
+
+// Function to hash the first and last bytes of the first len bytes of history (FNV-1a)
+static uint64_t history_fingerprint(size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    size_t head = len < HISTORY_FINGERPRINT_SPAN ? len : HISTORY_FINGERPRINT_SPAN;
+    size_t tail = len - head < HISTORY_FINGERPRINT_SPAN ? len - head : HISTORY_FINGERPRINT_SPAN;
+    for (size_t i = 0; i < head; i++) {
+        h = (h ^ (unsigned char)history.map[i]) * 1099511628211ULL;
+    }
+    for (size_t i = len - tail; i < len; i++) {
+        h = (h ^ (unsigned char)history.map[i]) * 1099511628211ULL;
+    }
+    return h ^ len;
+}
+
+// Function to (re)map the history file after it grew
+static void history_remap() {
+    struct stat st;
+    if (history.fd == -1 || fstat(history.fd, &st) == -1) {
+        return;
+    }
+    history.inode = st.st_ino;
+    if ((size_t)st.st_size == history.map_len) {
+        return;
+    }
+    if (history.map != NULL) {
+        munmap((void *)history.map, history.map_len);
+        history.map = NULL;
+        history.map_len = 0;
+    }
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, history.fd, 0);
+        if (map != MAP_FAILED) {
+            history.map = map;
+            history.map_len = st.st_size;
+        }
+    }
+}
+
+// Function to open and map the history file (cheap: no entry is read here)
+void history_open() {
+    if (history.fd != -1) {
+        return;
+    }
+    const char *path = getenv("HISTFILE");
+    StrBuf sb = {0};
+    if (path == NULL || *path == '\0') {
+        const char *home = getenv("HOME");
+        if (home == NULL) {
+            return;
+        }
+        strbuf_putn(&sb, home, strlen(home));
+        strbuf_putn(&sb, "/.quash_history", 15);
+        path = sb.data;
+    }
+    history.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history.fd == -1) {
+        free(sb.data);
+        return;
+    }
+    history.path = strdup(path);
+    history.owner = getpid();
+    free(sb.data);
+    history_remap();
+    atexit(history_save_index);
+}
+
+// Function to turn a command into its one-line history form
+static void history_encode(const char *text, size_t len, StrBuf *out) {
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            strbuf_putn(out, "\\n", 2);
+        } else if (text[i] == '\\') {
+            strbuf_putn(out, "\\\\", 2);
+        } else {
+            strbuf_putc(out, text[i]);
+        }
+    }
+}
+
+// Function to turn a history line back into the command text
+void history_decode(const char *line, size_t len, StrBuf *out) {
+    out->len = 0;
+    strbuf_putn(out, "", 0);
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '\\' && i + 1 < len) {
+            i++;
+            strbuf_putc(out, line[i] == 'n' ? '\n' : line[i]);
+        } else {
+            strbuf_putc(out, line[i]);
+        }
+    }
+}
+
+// Function to append a command to the history file
+void history_add(const char *text) {
+    size_t len = strlen(text);
+    while (len > 0 && isspace((unsigned char)text[len - 1])) {
+        len--;
+    }
+    if (history.fd == -1 || len == 0 || isspace((unsigned char)text[0])) {
+        return;  // Like bash's ignorespace: a leading blank keeps it out of history
+    }
+    if (history.last_added != NULL && strlen(history.last_added) == len &&
+        memcmp(history.last_added, text, len) == 0) {
+        return;
+    }
+    free(history.last_added);
+    history.last_added = strndup(text, len);
+
+    StrBuf entry = {0};
+    history_encode(text, len, &entry);
+    strbuf_putc(&entry, '\n');
+    if (write(history.fd, entry.data, entry.len) != (ssize_t)entry.len) {
+        perror("history");
+    }
+    free(entry.data);
+}
+
+// Function to get the delta postings of a trigram (creating them if asked)
+static HistDeltaTerm *delta_lookup(uint32_t trigram, int create) {
+    if (history.delta_capacity == 0) {
+        if (!create) {
+            return NULL;
+        }
+        history.delta_capacity = 4096;
+        history.delta = calloc(history.delta_capacity, sizeof(HistDeltaTerm));
+    } else if (create && (history.delta_terms + 1) * 10 > history.delta_capacity * 7) {
+        // Grow at 70% load
+        HistDeltaTerm *old = history.delta;
+        size_t old_capacity = history.delta_capacity;
+        history.delta_capacity *= 2;
+        history.delta = calloc(history.delta_capacity, sizeof(HistDeltaTerm));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].offsets != NULL) {
+                size_t slot = delta_slot(old[i].trigram);
+                while (history.delta[slot].offsets != NULL) {
+                    slot = (slot + 1) & (history.delta_capacity - 1);
+                }
+                history.delta[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+    if (history.delta == NULL) {
+        perror("calloc failed for history index");
+        exit(1);
+    }
+
+    size_t slot = delta_slot(trigram);
+    while (history.delta[slot].offsets != NULL) {
+        if (history.delta[slot].trigram == trigram) {
+            return &history.delta[slot];
+        }
+        slot = (slot + 1) & (history.delta_capacity - 1);
+    }
+    if (!create) {
+        return NULL;
+    }
+    HistDeltaTerm *term = &history.delta[slot];
+    term->trigram = trigram;
+    term->count = 0;
+    term->capacity = 4;
+    term->offsets = malloc(term->capacity * sizeof(uint64_t));
+    if (term->offsets == NULL) {
+        perror("malloc failed for history index");
+        exit(1);
+    }
+    history.delta_terms++;
+    return term;
+}
+
+// Function to find the on-disk postings of a trigram (binary search)
+static const HistIndexTerm *base_lookup(uint32_t trigram) {
+    size_t lo = 0;
+    size_t hi = history.term_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (history.terms[mid].trigram < trigram) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < history.term_count && history.terms[lo].trigram == trigram) ? &history.terms[lo] : NULL;
+}
+
+// Function to map the on-disk index, if there is a valid one for this file
+static void history_load_index() {
+    history.index_loaded = 1;
+    if (history.path == NULL) {
+        return;
+    }
+    StrBuf path = {0};
+    strbuf_putn(&path, history.path, strlen(history.path));
+    strbuf_putn(&path, ".idx", 4);
+    int fd = open(path.data, O_RDONLY | O_CLOEXEC);
+    free(path.data);
+    if (fd == -1) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(HistIndexHeader)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            const HistIndexHeader *header = map;
+            size_t expected = sizeof(HistIndexHeader) + header->term_count * sizeof(HistIndexTerm) +
+                              header->posting_count * sizeof(uint64_t);
+            // An index for other bytes than the file now holds belongs to a replaced
+            // or truncated file
+            if (memcmp(header->magic, HISTORY_INDEX_MAGIC, 8) == 0 && expected == (size_t)st.st_size &&
+                header->covered <= history.map_len && header->inode == history.inode &&
+                header->fingerprint == history_fingerprint(header->covered)) {
+                history.index_map = map;
+                history.index_len = st.st_size;
+                history.term_count = header->term_count;
+                history.terms = (const HistIndexTerm *)(header + 1);
+                history.postings = (const uint64_t *)(history.terms + header->term_count);
+                history.base_covered = history.covered = header->covered;
+                history.fingerprint = header->fingerprint;
+            } else {
+                munmap(map, st.st_size);
+            }
+        }
+    }
+    close(fd);
+}
+
+// Function to index entries written since the index was last brought up to date
+void history_index_tail() {
+    history_remap();
+    if (!history.index_loaded) {
+        history_load_index();
+    }
+
+    // Only whole lines: another shell may be half way through a write
+    size_t end = history.map_len;
+    while (end > history.covered && history.map[end - 1] != '\n') {
+        end--;
+    }
+
+    size_t pos = history.covered;
+    while (pos < end) {
+        const char *line = history.map + pos;
+        const char *newline = memchr(line, '\n', end - pos);
+        size_t len = newline - line;
+        for (size_t i = 0; i + 3 <= len; i++) {
+            HistDeltaTerm *term = delta_lookup(make_trigram(line + i), 1);
+            if (term->count > 0 && term->offsets[term->count - 1] == pos) {
+                continue;  // Already noted for this entry
+            }
+            if (term->count == term->capacity) {
+                term->capacity *= 2;
+                term->offsets = realloc(term->offsets, term->capacity * sizeof(uint64_t));
+                if (term->offsets == NULL) {
+                    perror("realloc failed for history index");
+                    exit(1);
+                }
+            }
+            term->offsets[term->count++] = pos;
+            history.delta_postings++;
+        }
+        pos += len + 1;
+    }
+    if (end != history.covered) {
+        history.covered = end;
+        history.fingerprint = history_fingerprint(end);  // The file may shrink before we save
+    }
+}
+
+static int compare_delta_terms(const void *a, const void *b) {
+    uint32_t x = (*(HistDeltaTerm *const *)a)->trigram;
+    uint32_t y = (*(HistDeltaTerm *const *)b)->trigram;
+    return (x > y) - (x < y);
+}
+
+// Function to write the on-disk index merged with the delta (at exit). The new
+// file is renamed into place, so readers always see a complete index.
+void history_save_index() {
+    if (history.delta_postings == 0 || history.path == NULL || getpid() != history.owner) {
+        return;
+    }
+
+    HistDeltaTerm **delta = malloc((history.delta_terms + 1) * sizeof(HistDeltaTerm *));
+    HistIndexTerm *terms = malloc((history.term_count + history.delta_terms + 1) * sizeof(HistIndexTerm));
+    if (delta == NULL || terms == NULL) {
+        free(delta);
+        free(terms);
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < history.delta_capacity; i++) {
+        if (history.delta[i].offsets != NULL) {
+            delta[n++] = &history.delta[i];
+        }
+    }
+    qsort(delta, n, sizeof(HistDeltaTerm *), compare_delta_terms);
+
+    // Merge the two sorted term lists into the new term table
+    size_t count = 0;
+    uint64_t first = 0;
+    for (size_t b = 0, d = 0; b < history.term_count || d < n;) {
+        uint32_t trigram;
+        if (d == n || (b < history.term_count && history.terms[b].trigram <= delta[d]->trigram)) {
+            trigram = history.terms[b].trigram;
+        } else {
+            trigram = delta[d]->trigram;
+        }
+        terms[count].trigram = trigram;
+        terms[count].count = 0;
+        terms[count].first = first;
+        if (b < history.term_count && history.terms[b].trigram == trigram) {
+            terms[count].count += history.terms[b++].count;
+        }
+        if (d < n && delta[d]->trigram == trigram) {
+            terms[count].count += delta[d++]->count;
+        }
+        first += terms[count].count;
+        count++;
+    }
+
+    StrBuf tmp = {0};
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".idx.%d", (int)getpid());
+    strbuf_putn(&tmp, history.path, strlen(history.path));
+    strbuf_putn(&tmp, suffix, strlen(suffix));
+    // Postings give away what the entries contain: keep the index as private as the file
+    unlink(tmp.data);
+    int fd = open(tmp.data, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    FILE *out = fd == -1 ? NULL : fdopen(fd, "w");
+    if (out == NULL && fd != -1) {
+        close(fd);
+        unlink(tmp.data);
+    }
+    if (out != NULL) {
+        HistIndexHeader header;
+        memcpy(header.magic, HISTORY_INDEX_MAGIC, 8);
+        header.covered = history.covered;
+        header.inode = history.inode;
+        header.fingerprint = history.fingerprint;
+        header.term_count = count;
+        header.posting_count = first;
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(terms, sizeof(HistIndexTerm), count, out);
+
+        // Old postings come before new ones, so every list stays sorted
+        for (size_t t = 0, d = 0; t < count; t++) {
+            const HistIndexTerm *base = base_lookup(terms[t].trigram);
+            if (base != NULL) {
+                fwrite(history.postings + base->first, sizeof(uint64_t), base->count, out);
+            }
+            if (d < n && delta[d]->trigram == terms[t].trigram) {
+                fwrite(delta[d]->offsets, sizeof(uint64_t), delta[d]->count, out);
+                d++;
+            }
+        }
+        StrBuf path = {0};
+        strbuf_putn(&path, history.path, strlen(history.path));
+        strbuf_putn(&path, ".idx", 4);
+        if (fclose(out) == 0) {
+            rename(tmp.data, path.data);
+        } else {
+            unlink(tmp.data);
+        }
+        free(path.data);
+    }
+    free(tmp.data);
+    free(terms);
+    free(delta);
+}
+
+static int compare_offsets(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to check whether the history line at offset contains pattern
+static int history_entry_matches(uint64_t offset, const StrBuf *pattern) {
+    const char *line = history.map + offset;
+    const char *newline = memchr(line, '\n', history.map_len - offset);
+    size_t len = newline ? (size_t)(newline - line) : history.map_len - offset;
+    return memmem(line, len, pattern->data, pattern->len) != NULL;
+}
+
+// Function to find the entries containing text. Returns their offsets, oldest
+// first, in a malloc'd array (count in *found).
+uint64_t *history_search(const char *text, size_t *found) {
+    StrBuf pattern = {0};
+    uint64_t *matches = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    *found = 0;
+    history_index_tail();
+    history_encode(text, strlen(text), &pattern);
+    if (pattern.len == 0) {
+        return NULL;
+    }
+
+    // Candidates: the postings of the rarest trigram of the pattern. Patterns
+    // shorter than a trigram fall back to a scan of every entry.
+    const HistIndexTerm *base = NULL;
+    HistDeltaTerm *delta = NULL;
+    int scan = (pattern.len < 3);
+    size_t best = SIZE_MAX;
+    for (size_t i = 0; !scan && i + 3 <= pattern.len; i++) {
+        uint32_t trigram = make_trigram(pattern.data + i);
+        const HistIndexTerm *b = history.term_count ? base_lookup(trigram) : NULL;
+        HistDeltaTerm *d = delta_lookup(trigram, 0);
+        size_t n = (b ? b->count : 0) + (d ? d->count : 0);
+        if (n < best) {
+            best = n;
+            base = b;
+            delta = d;
+        }
+    }
+
+    size_t candidates = scan ? 0 : best;
+    for (size_t i = 0; i < candidates; i++) {
+        uint64_t offset = (base && i < base->count) ? history.postings[base->first + i]
+                                                    : delta->offsets[i - (base ? base->count : 0)];
+        if (!history_entry_matches(offset, &pattern)) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            matches = realloc(matches, capacity * sizeof(uint64_t));
+        }
+        matches[count++] = offset;
+    }
+    for (size_t pos = 0; scan && pos < history.covered;) {
+        const char *newline = memchr(history.map + pos, '\n', history.covered - pos);
+        if (history_entry_matches(pos, &pattern)) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                matches = realloc(matches, capacity * sizeof(uint64_t));
+            }
+            matches[count++] = pos;
+        }
+        pos = newline - history.map + 1;
+    }
+    free(pattern.data);
+
+    if (count > 1 && !scan) {
+        qsort(matches, count, sizeof(uint64_t), compare_offsets);
+    }
+    *found = count;
+    return matches;
+}
+
+// Function to get the history line starting at offset (without its '\n')
+size_t history_line_at(uint64_t offset, const char **line) {
+    *line = history.map + offset;
+    const char *newline = memchr(*line, '\n', history.map_len - offset);
+    return newline ? (size_t)(newline - *line) : history.map_len - offset;
+}
+
+// Function to find the start of the entry before offset (offset itself if none)
+uint64_t history_prev(uint64_t offset) {
+    if (offset == 0) {
+        return 0;
+    }
+    uint64_t pos = offset - 1;  // The '\n' ending the previous entry
+    while (pos > 0 && history.map[pos - 1] != '\n') {
+        pos--;
+    }
+    return pos;
+}
+
+static void history_print_entry(uint64_t offset, StrBuf *text) {
+    const char *line;
+    size_t len = history_line_at(offset, &line);
+    history_decode(line, len, text);
+    out_printf(STDOUT_FILENO, "%s\n", text->data);
+}
+
+// Built-in function to handle 'history [N]' (last N entries, default 20) and
+// 'history -s PATTERN' (every entry containing PATTERN)
+void quash_history(char **args) {
+    StrBuf text = {0};
+
+    history_open();
+    history_remap();
+    if (history.map == NULL) {
+        return;
+    }
+
+    if (args[1] != NULL && strcmp(args[1], "-s") == 0) {
+        if (args[2] == NULL) {
+            fprintf(stderr, "Usage: history -s PATTERN\n");
+            builtin_status = 2;
+            return;
+        }
+        size_t found;
+        uint64_t *matches = history_search(args[2], &found);
+        for (size_t i = 0; i < found; i++) {
+            history_print_entry(matches[i], &text);
+        }
+        free(matches);
+        builtin_status = (found == 0);
+    } else {
+        long n = args[1] != NULL ? atol(args[1]) : 20;
+        uint64_t end = history.map_len;
+        while (end > 0 && history.map[end - 1] != '\n') {
+            end--;  // Skip a partial entry being written
+        }
+        uint64_t start = end;
+        for (long i = 0; i < n && start > 0; i++) {
+            start = history_prev(start);
+        }
+        while (start < end) {
+            const char *line;
+            size_t len = history_line_at(start, &line);
+            history_print_entry(start, &text);
+            start += len + 1;
+        }
+    }
+    free(text.data);
+}
+
+//============================================completion++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Tab completes the word under the cursor: a command name in command position,
+// otherwise a file name. Command names come from an index of every executable
+// in $PATH, built once (when the first prompt is shown) and then kept up to date
+// from inotify events on the PATH directories, so a keystroke never rescans
+// them. It is rebuilt only when $PATH itself changes. File names come from
+// getdents64 listings kept in a small cache that is revalidated by mtime.
+
+typedef struct {
+    char *name;
+    uint64_t dirs;            // Bit i set: executable in PATH directory i
+} PathCommand;
+
+typedef struct {
+    char *path_env;           // $PATH the index was built for (NULL: not built)
+    int stale;                // Rebuild on next use (inotify queue overflowed)
+    int inotify_fd;
+    char *dirs[PATH_INDEX_MAX_DIRS];
+    int wds[PATH_INDEX_MAX_DIRS];  // Watch of each directory, -1 if gone
+    int dir_count;
+    PathCommand *commands;    // Sorted by name
+    int count;
+    int capacity;
+    unsigned long updates;    // Changes applied from inotify events
+} PathIndex;
+
+PathIndex path_index = { .inotify_fd = -1 };
+
+DirListing *complete_cache[COMPLETE_DIR_CACHE_SIZE];
+
+// Command prefixes, which are not in the command table
+static const char *prefix_names[] = { "timeout", NULL };
+
+// Function to find where name is (or would go) in the index
+static int path_index_find(const char *name, int *found) {
+    int lo = 0;
+    int hi = path_index.count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(path_index.commands[mid].name, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = (lo < path_index.count && strcmp(path_index.commands[lo].name, name) == 0);
+    return lo;
+}
+
+// Function to record whether name is an executable in PATH directory dir
+static void path_index_set(const char *name, int dir, int present) {
+    int found;
+    int i = path_index_find(name, &found);
+    uint64_t bit = (uint64_t)1 << dir;
+
+    if (present && !found) {
+        if (path_index.count == path_index.capacity) {
+            path_index.capacity = path_index.capacity ? path_index.capacity * 2 : 1024;
+            path_index.commands = realloc(path_index.commands, path_index.capacity * sizeof(PathCommand));
+            if (path_index.commands == NULL) {
+                perror("realloc failed for command index");
+                exit(1);
+            }
+        }
+        memmove(&path_index.commands[i + 1], &path_index.commands[i],
+                (path_index.count - i) * sizeof(PathCommand));
+        path_index.commands[i].name = strdup(name);
+        path_index.commands[i].dirs = bit;
+        path_index.count++;
+    } else if (present) {
+        path_index.commands[i].dirs |= bit;
+    } else if (found) {
+        path_index.commands[i].dirs &= ~bit;
+        if (path_index.commands[i].dirs == 0) {
+            free(path_index.commands[i].name);
+            path_index.count--;
+            memmove(&path_index.commands[i], &path_index.commands[i + 1],
+                    (path_index.count - i) * sizeof(PathCommand));
+        }
+    }
+}
+
+// Function to check whether dir/name is a file we could run
+static int path_index_is_executable(int dir, const char *name) {
+    StrBuf path = {0};
+    struct stat st;
+    strbuf_putn(&path, path_index.dirs[dir], strlen(path_index.dirs[dir]));
+    strbuf_putc(&path, '/');
+    strbuf_putn(&path, name, strlen(name));
+    int ok = (stat(path.data, &st) == 0 && S_ISREG(st.st_mode) && access(path.data, X_OK) == 0);
+    free(path.data);
+    return ok;
+}
+
+// Function to apply the inotify events queued for the PATH directories
+static void path_index_changed(int fd, void *ctx) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    (void)ctx;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                path_index.stale = 1;  // Events were lost; start over
+                continue;
+            }
+            int dir = 0;
+            while (dir < path_index.dir_count && path_index.wds[dir] != ev->wd) {
+                dir++;
+            }
+            if (dir == path_index.dir_count) {
+                continue;
+            }
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // The directory itself went away: so did its commands
+                for (int i = path_index.count - 1; i >= 0; i--) {
+                    if (path_index.commands[i].dirs & ((uint64_t)1 << dir)) {
+                        path_index_set(path_index.commands[i].name, dir, 0);
+                    }
+                }
+                path_index.wds[dir] = -1;
+            } else if (ev->len > 0 && (ev->mask & (IN_DELETE | IN_MOVED_FROM))) {
+                path_index_set(ev->name, dir, 0);
+            } else if (ev->len > 0) {
+                // Created, moved in or chmod'ed
+                path_index_set(ev->name, dir, path_index_is_executable(dir, ev->name));
+            }
+            path_index.updates++;
+        }
+    }
+}
+
+static void path_index_free() {
+    if (path_index.inotify_fd != -1) {
+        event_remove(path_index.inotify_fd);
+        close(path_index.inotify_fd);
+        path_index.inotify_fd = -1;
+    }
+    for (int i = 0; i < path_index.count; i++) {
+        free(path_index.commands[i].name);
+    }
+    for (int i = 0; i < path_index.dir_count; i++) {
+        free(path_index.dirs[i]);
+    }
+    free(path_index.path_env);
+    path_index.path_env = NULL;
+    path_index.count = 0;
+    path_index.dir_count = 0;
+    path_index.stale = 0;
+}
+
+// Function to index every executable in $PATH. Relative entries (such as '.')
+// are skipped: what they name changes with the working directory.
+static void path_index_build(const char *path_env) {
+    path_index_free();
+    path_index.path_env = strdup(path_env);
+    path_index.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (path_index.inotify_fd != -1) {
+        event_add(path_index.inotify_fd, path_index_changed, NULL);
+    }
+
+    const char *start = path_env;
+    while (*start != '\0' && path_index.dir_count < PATH_INDEX_MAX_DIRS) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        char *dir = strndup(start, len);
+        start += len + (end != NULL);
+
+        int duplicate = (dir[0] != '/');
+        for (int i = 0; i < path_index.dir_count && !duplicate; i++) {
+            duplicate = (strcmp(path_index.dirs[i], dir) == 0);
+        }
+        if (duplicate) {
+            free(dir);
+            continue;
+        }
+
+        // Watch first, so nothing created while we read the directory is missed
+        int d = path_index.dir_count++;
+        path_index.dirs[d] = dir;
+        path_index.wds[d] = path_index.inotify_fd == -1 ? -1 :
+            inotify_add_watch(path_index.inotify_fd, dir,
+                              IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                              IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        DirListing *listing = read_dir_listing(dir);
+        for (int i = 0; listing != NULL && i < listing->count; i++) {
+            const char *name = listing->names + listing->offsets[i];
+            if (listing->types[i] != DT_DIR && path_index_is_executable(d, name)) {
+                path_index_set(name, d, 1);
+            }
+        }
+        free_dir_listing(listing);
+    }
+}
+
+// Function to bring the command index up to date: built on first use or after
+// $PATH changed, otherwise just the pending inotify events
+void path_index_sync() {
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "";
+    }
+    if (path_index.path_env == NULL || path_index.stale || strcmp(path_index.path_env, path_env) != 0) {
+        path_index_build(path_env);
+    } else if (path_index.inotify_fd != -1) {
+        path_index_changed(path_index.inotify_fd, NULL);
+    }
+}
+
+// Function to add the builtins and PATH commands starting with prefix
+static void complete_commands(const char *prefix, ArgList *out) {
+    size_t len = strlen(prefix);
+    int found;
+
+    for (int i = 0; prefix_names[i] != NULL; i++) {
+        if (strncmp(prefix_names[i], prefix, len) == 0) {
+            arglist_push(out, strdup(prefix_names[i]));
+        }
+    }
+    command_names(prefix, out);  // Builtins, aliases and functions
+    path_index_sync();
+    for (int i = path_index_find(prefix, &found); i < path_index.count; i++) {
+        if (strncmp(path_index.commands[i].name, prefix, len) != 0) {
+            break;  // Sorted: every match is in one run
+        }
+        arglist_push(out, strdup(path_index.commands[i].name));
+    }
+}
+
+// Function to add the file names completing word ('src/ma' -> 'src/main.c').
+// Directories get a trailing '/'.
+static void complete_files(const char *word, ArgList *out) {
+    static int next_slot = 0;
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    size_t base_len = strlen(base);
+    StrBuf dir = {0};
+    StrBuf full = {0};
+    int hit;
+
+    // '~/...' is looked up in $HOME but completed as typed
+    if (word[0] == '~' && slash != NULL && slash == strchr(word, '/') && getenv("HOME") != NULL) {
+        strbuf_putn(&dir, getenv("HOME"), strlen(getenv("HOME")));
+        strbuf_putn(&dir, word + 1, slash - word);
+    } else if (slash != NULL) {
+        strbuf_putn(&dir, word, slash - word + 1);
+    } else {
+        strbuf_putn(&dir, ".", 1);
+    }
+
+    DirListing *listing = cached_dir_listing(complete_cache, COMPLETE_DIR_CACHE_SIZE, &next_slot, dir.data, &hit);
+    for (int i = 0; listing != NULL && i < listing->count; i++) {
+        const char *name = listing->names + listing->offsets[i];
+        if (strncmp(name, base, base_len) != 0 || (name[0] == '.' && base[0] != '.')) {
+            continue;
+        }
+        full.len = 0;
+        strbuf_putn(&full, word, base - word);
+        strbuf_putn(&full, name, strlen(name));
+        if (listing->types[i] == DT_DIR || listing->types[i] == DT_LNK || listing->types[i] == DT_UNKNOWN) {
+            StrBuf real = {0};
+            if (slash != NULL) {
+                strbuf_putn(&real, dir.data, dir.len);
+            }
+            strbuf_putn(&real, name, strlen(name));
+            if (listing_is_dir(listing, i, real.data)) {
+                strbuf_putc(&full, '/');
+            }
+            free(real.data);
+        }
+        arglist_push(out, strdup(full.data));
+    }
+    free(dir.data);
+    free(full.data);
+}
+
+// Function to sort candidates and drop repeats (a builtin also found in PATH)
+static void complete_sort_unique(ArgList *list) {
+    if (list->count < 2) {
+        return;
+    }
+    qsort(list->items, list->count, sizeof(char *), compare_strings);
+    int kept = 1;
+    for (int i = 1; i < list->count; i++) {
+        if (strcmp(list->items[i], list->items[kept - 1]) == 0) {
+            free(list->items[i]);
+        } else {
+            list->items[kept++] = list->items[i];
+        }
+    }
+    list->count = kept;
+}
+
+// Function to check whether the word starting at start is a command name
+static int complete_in_command_position(const char *text, size_t start) {
+    static const char *keywords[] = { "do", "then", "else", "elif", "if", "while", "until", "timeout", NULL };
+    size_t end = start;
+    while (end > 0 && (text[end - 1] == ' ' || text[end - 1] == '\t')) {
+        end--;
+    }
+    if (end == 0 || strchr(";|&(!", text[end - 1]) != NULL) {
+        return 1;
+    }
+    size_t word = end;
+    while (word > 0 && text[word - 1] != ' ' && text[word - 1] != '\t' && strchr(";|&(", text[word - 1]) == NULL) {
+        word--;
+    }
+    for (int i = 0; keywords[i] != NULL; i++) {
+        if (strlen(keywords[i]) == end - word && strncmp(text + word, keywords[i], end - word) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Function to find the candidates for the word ending at cursor. Sets *start to
+// where the word begins and word to its text with backslash escapes removed.
+// Returns the sorted, de-duplicated candidates in out.
+void complete_word(const char *text, size_t cursor, size_t *start, StrBuf *word, ArgList *out) {
+    size_t word_start = 0;
+    for (size_t i = 0; i < cursor; i++) {
+        if (text[i] == '\\' && i + 1 < cursor) {
+            i++;
+        } else if (strchr(" \t;|&<>()", text[i]) != NULL) {
+            word_start = i + 1;
+        }
+    }
+    word->len = 0;
+    strbuf_putn(word, "", 0);
+    for (size_t i = word_start; i < cursor; i++) {
+        if (text[i] == '\\' && i + 1 < cursor) {
+            i++;
+        }
+        strbuf_putc(word, text[i]);
+    }
+    *start = word_start;
+
+    if (complete_in_command_position(text, word_start) && strchr(word->data, '/') == NULL) {
+        complete_commands(word->data, out);
+    } else {
+        complete_files(word->data, out);
+    }
+    complete_sort_unique(out);
+}
+
+// Function to escape a completed word so it reads back as one word
+void complete_escape(const char *word, StrBuf *out) {
+    for (const char *p = word; *p != '\0'; p++) {
+        if (strchr(" \t\n'\"\\$`&;|<>()*?[]{}!#", *p) != NULL) {
+            strbuf_putc(out, '\\');
+        }
+        strbuf_putc(out, *p);
+    }
+}
+
+// Built-in function to handle 'compgen -c PREFIX' (commands) and 'compgen -f PREFIX'
+// (files): print what Tab would offer, one per line
+void quash_compgen(char **args) {
+    ArgList out = {0};
+    const char *prefix = (args[1] != NULL && args[2] != NULL) ? args[2] : "";
+
+    if (args[1] == NULL || (strcmp(args[1], "-c") != 0 && strcmp(args[1], "-f") != 0)) {
+        fprintf(stderr, "Usage: compgen -c|-f [PREFIX]\n");
+        builtin_status = 2;
+        return;
+    }
+    if (args[1][1] == 'c') {
+        complete_commands(prefix, &out);
+    } else {
+        complete_files(prefix, &out);
+    }
+    complete_sort_unique(&out);
+    for (int i = 0; i < out.count; i++) {
+        out_printf(STDOUT_FILENO, "%s\n", out.items[i]);
+    }
+    builtin_status = (out.count == 0);
+    arglist_free(&out);
+}
+
+//============================================line editor++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Interactive input is read with the terminal in raw mode so keys can edit the
+// line: arrows, Home/End, Ctrl-A/E/B/F/K/U/W/L, Up/Down to walk history and
+// Ctrl-R to search it. The event loop keeps running while we wait for a key.
+
+enum {
+    KEY_NONE = -1,
+    KEY_UP = 1000,
+    KEY_DOWN,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE
+};
+
+typedef struct {
+    StrBuf text;            // Line being edited
+    size_t cursor;
+    const char *prompt;
+    uint64_t hist_end;      // End of the last complete history entry
+    uint64_t hist_pos;      // Entry being shown (hist_end: the line being typed)
+    StrBuf saved;           // Line being typed while browsing history
+    int searching;          // In Ctrl-R mode
+    StrBuf query;
+    uint64_t *matches;      // Entries containing query, oldest first
+    size_t match_count;
+    size_t match_index;     // Entry shown; match_count when there is none
+} LineEditor;
+
+struct termios saved_termios;
+
+static void editor_set_text(LineEditor *ed, const char *text, size_t len) {
+    ed->text.len = 0;
+    strbuf_putn(&ed->text, text, len);
+    ed->cursor = ed->text.len;
+}
+
+static void editor_load_history(LineEditor *ed, uint64_t offset) {
+    const char *line;
+    size_t len = history_line_at(offset, &line);
+    StrBuf decoded = {0};
+    history_decode(line, len, &decoded);
+    editor_set_text(ed, decoded.data, decoded.len);
+    free(decoded.data);
+}
+
+// Function to redraw the prompt and line, leaving the cursor where it belongs
+static void editor_refresh(LineEditor *ed) {
+    StrBuf out = {0};
+    strbuf_putc(&out, '\r');
+    if (ed->searching) {
+        if (ed->query.len > 0 && ed->match_index == ed->match_count) {
+            strbuf_putn(&out, "(failed ", 8);  // Nothing matches; the last match stays shown
+        } else {
+            strbuf_putc(&out, '(');
+        }
+        strbuf_putn(&out, "reverse-i-search)`", 18);
+        strbuf_putn(&out, ed->query.data ? ed->query.data : "", ed->query.len);
+        strbuf_putn(&out, "': ", 3);
+    } else {
+        strbuf_putn(&out, ed->prompt, strlen(ed->prompt));
+    }
+    strbuf_putn(&out, ed->text.data ? ed->text.data : "", ed->text.len);
+    strbuf_putn(&out, "\x1b[K", 3);
+    if (ed->cursor < ed->text.len) {
+        char move[32];
+        snprintf(move, sizeof(move), "\x1b[%zuD", ed->text.len - ed->cursor);
+        strbuf_putn(&out, move, strlen(move));
+    }
+    out_write(STDOUT_FILENO, out.data, out.len);
+    out_flush(STDOUT_FILENO);
+    free(out.data);
+}
+
+// Function to read one byte, waiting at most timeout_ms (-1: forever, servicing events)
+static int editor_read_byte(int timeout_ms) {
+    unsigned char c;
+    if (timeout_ms < 0) {
+        while (!event_loop_once(-1, STDIN_FILENO)) {
+            // Jobs, timers and captures keep running while the user types
+        }
+    } else {
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return KEY_NONE;
+        }
+    }
+    ssize_t n = read(STDIN_FILENO, &c, 1);
+    if (n == 1) {
+        return c;
+    }
+    return (n == -1 && (errno == EINTR || errno == EAGAIN)) ? KEY_NONE : 4;  // EOF acts as Ctrl-D
+}
+
+// Function to read a key, decoding the escape sequences of arrows and friends
+static int editor_read_key() {
+    int c = editor_read_byte(-1);
+    if (c != 27) {
+        return c;
+    }
+    int c1 = editor_read_byte(50);
+    if (c1 != '[' && c1 != 'O') {
+        return 27;
+    }
+    int c2 = editor_read_byte(50);
+    if (c2 >= '0' && c2 <= '9') {
+        int c3 = editor_read_byte(50);
+        while (c3 != '~' && c3 != KEY_NONE) {
+            c3 = editor_read_byte(50);  // Skip modifiers such as ';5'
+        }
+        switch (c2) {
+        case '1': case '7': return KEY_HOME;
+        case '4': case '8': return KEY_END;
+        case '3': return KEY_DELETE;
+        }
+        return KEY_NONE;
+    }
+    switch (c2) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    }
+    return KEY_NONE;
+}
+
+static void editor_delete(LineEditor *ed, size_t from, size_t to) {
+    memmove(ed->text.data + from, ed->text.data + to, ed->text.len - to + 1);
+    ed->text.len -= to - from;
+    ed->cursor = from;
+}
+
+static void editor_insert(LineEditor *ed, const char *s, size_t len) {
+    size_t tail = ed->text.len - ed->cursor;
+    strbuf_putn(&ed->text, s, len);  // Grow; the bytes are moved into place below
+    memmove(ed->text.data + ed->cursor + len, ed->text.data + ed->cursor, tail);
+    memcpy(ed->text.data + ed->cursor, s, len);
+    ed->text.data[ed->text.len] = '\0';
+    ed->cursor += len;
+}
+
+// Function to show the newest match of the search at or before match_index
+// whose text differs from what is shown now (Ctrl-R again skips repeats)
+static void editor_show_match(LineEditor *ed, size_t start) {
+    for (size_t i = start; i-- > 0;) {
+        const char *line;
+        size_t len = history_line_at(ed->matches[i], &line);
+        StrBuf decoded = {0};
+        history_decode(line, len, &decoded);
+        int same = (ed->match_index < ed->match_count && decoded.len == ed->text.len &&
+                    memcmp(decoded.data, ed->text.data, decoded.len) == 0);
+        if (!same) {
+            ed->match_index = i;
+            editor_set_text(ed, decoded.data, decoded.len);
+            free(decoded.data);
+            return;
+        }
+        free(decoded.data);
+    }
+}
+
+static void editor_search(LineEditor *ed) {
+    free(ed->matches);
+    ed->matches = history_search(ed->query.data ? ed->query.data : "", &ed->match_count);
+    ed->match_index = ed->match_count;
+    editor_show_match(ed, ed->match_count);
+}
+
+// Function to handle a key while in Ctrl-R mode. Returns 1 if the key ended
+// the search and should be handled as a normal key too.
+static int editor_search_key(LineEditor *ed, int key) {
+    if (key == 18) {  // Ctrl-R: next older match
+        editor_show_match(ed, ed->match_index < ed->match_count ? ed->match_index : ed->match_count);
+        return 0;
+    }
+    if (key == 127 || key == 8) {
+        if (ed->query.len > 0) {
+            ed->query.data[--ed->query.len] = '\0';
+            editor_search(ed);
+        }
+        return 0;
+    }
+    if (key == 7 || key == 3) {  // Ctrl-G / Ctrl-C: back to what was typed
+        ed->searching = 0;
+        editor_set_text(ed, ed->saved.data ? ed->saved.data : "", ed->saved.len);
+        return 0;
+    }
+    if (key >= 32 && key < 127) {
+        strbuf_putc(&ed->query, (char)key);
+        editor_search(ed);
+        return 0;
+    }
+    ed->searching = 0;  // Keep the match and let the key act on it
+    return 1;
+}
+
+// Function to print candidates in columns under the line being edited
+static void editor_list_candidates(ArgList *candidates) {
+    struct winsize ws;
+    int width = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) ? ws.ws_col : 80;
+    int shown = candidates->count < COMPLETE_LIST_MAX ? candidates->count : COMPLETE_LIST_MAX;
+    size_t longest = 0;
+    for (int i = 0; i < shown; i++) {
+        size_t len = strlen(candidates->items[i]);
+        longest = len > longest ? len : longest;
+    }
+    int columns = width / (int)(longest + 2);
+    if (columns < 1) {
+        columns = 1;
+    }
+    int rows = (shown + columns - 1) / columns;
+
+    out_printf(STDOUT_FILENO, "\n");
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < columns; c++) {
+            int i = c * rows + r;
+            if (i < shown) {
+                out_printf(STDOUT_FILENO, "%-*s", (int)(longest + 2), candidates->items[i]);
+            }
+        }
+        out_printf(STDOUT_FILENO, "\n");
+    }
+    if (shown < candidates->count) {
+        out_printf(STDOUT_FILENO, "(%d more)\n", candidates->count - shown);
+    }
+}
+
+// Function to complete the word before the cursor. The common prefix of the
+// candidates is inserted; when that adds nothing, a second Tab lists them.
+static void editor_complete(LineEditor *ed, int list) {
+    ArgList candidates = {0};
+    StrBuf word = {0};
+    size_t start;
+
+    complete_word(ed->text.data, ed->cursor, &start, &word, &candidates);
+    if (candidates.count > 0) {
+        const char *first = candidates.items[0];
+        size_t common = strlen(first);
+        for (int i = 1; i < candidates.count; i++) {
+            size_t j = 0;
+            while (j < common && candidates.items[i][j] == first[j]) {
+                j++;
+            }
+            common = j;
+        }
+
+        if (common > word.len || candidates.count == 1) {
+            StrBuf replacement = {0};
+            char *prefix = strndup(first, common);
+            complete_escape(prefix, &replacement);
+            if (candidates.count == 1 && first[common - 1] != '/') {
+                strbuf_putc(&replacement, ' ');  // Done with this word
+            }
+            editor_delete(ed, start, ed->cursor);
+            editor_insert(ed, replacement.data, replacement.len);
+            free(prefix);
+            free(replacement.data);
+        } else if (list) {
+            editor_list_candidates(&candidates);
+        }
+    }
+    free(word.data);
+    arglist_free(&candidates);
+}
+
+// Function to read one line from the terminal with editing. Returns 1 with the
+// line (ending in '\n') in line, 0 at end of input, -1 if Ctrl-C discarded it.
+int edit_line(const char *prompt, StrBuf *line) {
+    LineEditor ed;
+    int result = 1;
+
+    memset(&ed, 0, sizeof(ed));
+    ed.prompt = prompt;
+    strbuf_putn(&ed.text, "", 0);
+    history_remap();
+    ed.hist_end = history.map_len;
+    while (ed.hist_end > 0 && history.map[ed.hist_end - 1] != '\n') {
+        ed.hist_end--;
+    }
+    ed.hist_pos = ed.hist_end;
+
+    struct termios raw;
+    tcgetattr(STDIN_FILENO, &saved_termios);
+    raw = saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    editor_refresh(&ed);
+    path_index_sync();  // Cheap once built; the first build overlaps with typing
+    int last_key = KEY_NONE;
+    while (1) {
+        int key = editor_read_key();
+        if (key == KEY_NONE) {
+            continue;
+        }
+        int tab_again = (key == '\t' && last_key == '\t');
+        last_key = key;
+        if (ed.searching && !editor_search_key(&ed, key)) {
+            editor_refresh(&ed);
+            continue;
+        }
+
+        if (key == '\r' || key == '\n') {
+            break;
+        } else if (key == 3) {  // Ctrl-C
+            out_printf(STDOUT_FILENO, "^C");
+            result = -1;
+            break;
+        } else if (key == 4) {  // Ctrl-D
+            if (ed.text.len == 0) {
+                result = 0;
+                break;
+            }
+            if (ed.cursor < ed.text.len) {
+                editor_delete(&ed, ed.cursor, ed.cursor + 1);
+            }
+        } else if (key == 127 || key == 8) {
+            if (ed.cursor > 0) {
+                editor_delete(&ed, ed.cursor - 1, ed.cursor);
+            }
+        } else if (key == KEY_DELETE) {
+            if (ed.cursor < ed.text.len) {
+                editor_delete(&ed, ed.cursor, ed.cursor + 1);
+            }
+        } else if (key == KEY_LEFT || key == 2) {
+            if (ed.cursor > 0) {
+                ed.cursor--;
+            }
+        } else if (key == KEY_RIGHT || key == 6) {
+            if (ed.cursor < ed.text.len) {
+                ed.cursor++;
+            }
+        } else if (key == KEY_HOME || key == 1) {
+            ed.cursor = 0;
+        } else if (key == KEY_END || key == 5) {
+            ed.cursor = ed.text.len;
+        } else if (key == 11) {  // Ctrl-K
+            editor_delete(&ed, ed.cursor, ed.text.len);
+            ed.cursor = ed.text.len;
+        } else if (key == 21) {  // Ctrl-U
+            editor_delete(&ed, 0, ed.cursor);
+        } else if (key == 23) {  // Ctrl-W: the word before the cursor
+            size_t start = ed.cursor;
+            while (start > 0 && ed.text.data[start - 1] == ' ') {
+                start--;
+            }
+            while (start > 0 && ed.text.data[start - 1] != ' ') {
+                start--;
+            }
+            editor_delete(&ed, start, ed.cursor);
+        } else if (key == '\t') {
+            editor_complete(&ed, tab_again);
+        } else if (key == 12) {  // Ctrl-L
+            out_printf(STDOUT_FILENO, "\x1b[H\x1b[2J");
+        } else if ((key == KEY_UP || key == 16) && ed.hist_pos > 0) {
+            if (ed.hist_pos == ed.hist_end) {
+                ed.saved.len = 0;
+                strbuf_putn(&ed.saved, ed.text.data, ed.text.len);
+            }
+            ed.hist_pos = history_prev(ed.hist_pos);
+            editor_load_history(&ed, ed.hist_pos);
+        } else if ((key == KEY_DOWN || key == 14) && ed.hist_pos < ed.hist_end) {
+            const char *entry;
+            ed.hist_pos += history_line_at(ed.hist_pos, &entry) + 1;
+            if (ed.hist_pos >= ed.hist_end) {
+                ed.hist_pos = ed.hist_end;
+                editor_set_text(&ed, ed.saved.data ? ed.saved.data : "", ed.saved.len);
+            } else {
+                editor_load_history(&ed, ed.hist_pos);
+            }
+        } else if (key == 18) {  // Ctrl-R
+            ed.searching = 1;
+            ed.saved.len = 0;
+            strbuf_putn(&ed.saved, ed.text.data, ed.text.len);
+            ed.query.len = 0;
+            strbuf_putn(&ed.query, "", 0);
+            free(ed.matches);
+            ed.matches = NULL;
+            ed.match_count = ed.match_index = 0;
+        } else if (key >= 32 && key < 127) {
+            char c = (char)key;
+            editor_insert(&ed, &c, 1);
+        } else if (key >= 128 && key < 256) {
+            char c = (char)key;  // Bytes of UTF-8 text pass through unchanged
+            editor_insert(&ed, &c, 1);
+        }
+        editor_refresh(&ed);
+    }
+
+    if (ed.searching || result == 1) {
+        ed.searching = 0;
+        editor_refresh(&ed);  // Show the line as it will run, not the search
+    }
+    out_printf(STDOUT_FILENO, "\r\n");
+    out_flush(STDOUT_FILENO);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved_termios);
+
+    line->len = 0;
+    if (result == 1) {
+        strbuf_putn(line, ed.text.data, ed.text.len);
+        strbuf_putc(line, '\n');
+    }
+    free(ed.text.data);
+    free(ed.saved.data);
+    free(ed.query.data);
+    free(ed.matches);
+    return result;
+}
+
+//============================================interpreter++++++++++++++++++++++++++++++++++++++++++++++++++++
+// The tree is walked in-process: builtins in loop bodies never fork, only external
+// commands and pipelines do.
+
+// Function to name a job after the first command word in a tree
+const char *job_label(Node *node) {
+    while (node != NULL) {
+        switch (node->type) {
+        case NODE_SIMPLE:
+            return node->word_count > 0 ? node->words[0] : "";
+        case NODE_LIST:
+        case NODE_PIPELINE:
+            node = node->body;
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            node = node->left;
+            break;
+        case NODE_FOR:
+            return "for";
+        case NODE_WHILE:
+            return "while";
+        case NODE_UNTIL:
+            return "until";
+        case NODE_IF:
+            return "if";
+        case NODE_FUNCTION:
+            return node->name;
+        }
+    }
+    return "";
+}
+
+// Function to run a simple command node: assignments, builtins or an external program
+static int exec_simple(Node *node, int background) {
+    if (is_assignment_only(node)) {
+        for (int i = 0; i < node->word_count; i++) {
+            char *eq = strchr(node->words[i], '=');
+            char *name = strndup(node->words[i], eq - node->words[i]);
+            ArgList value = {0};
+            expand_word(eq + 1, &value, 0);
+            set_shell_variable(name, value.count > 0 ? value.items[0] : "");
+            arglist_free(&value);
+            free(name);
+        }
+        return 0;
+    }
+
+    ArgList list = {0};
+    expand_command_words(node, &list);
+    if (list.count == 0) {
+        return 0;
+    }
+
+    // Commands are free to shuffle their argv, so hand them a copy of the pointers
+    char **args = malloc((list.count + 1) * sizeof(char *));
+    if (args == NULL) {
+        perror("malloc failed for arguments");
+        arglist_free(&list);
+        return 1;
+    }
+    memcpy(args, list.items, list.count * sizeof(char *));
+    args[list.count] = NULL;
+
+    int status = execute_simple_command(args, background);
+
+    free(args);
+    arglist_free(&list);
+    return status;
+}
+
+// Function to run a list item after '&' in a background child
+static int exec_background(Node *node) {
+    if (node->type == NODE_SIMPLE && !is_function_call(node)) {
+        return exec_simple(node, 1);
+    }
+
+    int capture_fds[2];
+    int capturing = (capture_begin(capture_fds) == 0);
+
+    pid_t pid = fork_job(job_group_for(1), 0);
+    if (pid == 0) {
+        if (capturing) {
+            capture_child(capture_fds);
+        }
+        int status = exec_node(node);
+        out_flush_all();
+        _exit(status);
+    } else if (pid < 0) {
+        perror("fork failed");
+        if (capturing) {
+            close(capture_fds[0]);
+            close(capture_fds[1]);
+        }
+        return 1;
+    }
+
+    const char *label = job_label(node);
+    add_job(pid, (char *)label);
+    if (capturing) {
+        capture_attach(capture_fds);
+    }
+    arm_job_deadline(NULL);
+    if (!rc_running) {
+        out_printf(STDOUT_FILENO, "Background job started: [%d] %d %s\n", last_job_id, pid, label);
+    }
+    return 0;
+}
+
+// Function to decide whether a loop should stop after running its body
+static int loop_should_stop() {
+    if (return_pending || interrupted) {
+        return 1;
+    }
+    if (break_levels > 0) {
+        break_levels--;
+        return 1;
+    }
+    if (continue_levels > 0) {
+        // 'continue N' with N > 1 continues an enclosing loop
+        continue_levels--;
+        return continue_levels > 0;
+    }
+    return 0;
+}
+
+static int exec_for(Node *node) {
+    ArgList items = {0};
+    int status = 0;
+
+    if (node->words == NULL) {
+        // 'for NAME' without 'in' walks "$@"; copied, as the body may shift them
+        for (int i = 0; i < positional_count; i++) {
+            arglist_push(&items, strdup(positional_args[i]));
+        }
+    }
+    for (int i = 0; i < node->word_count; i++) {
+        expand_word(node->words[i], &items, 1);
+    }
+
+    loop_depth++;
+    for (int i = 0; i < items.count; i++) {
+        set_shell_variable(node->name, items.items[i]);
+        status = exec_node(node->body);
+        if (loop_should_stop()) {
+            break;
+        }
+    }
+    loop_depth--;
+
+    arglist_free(&items);
+    return status;
+}
+
+static int exec_while(Node *node) {
+    int status = 0;
+
+    loop_depth++;
+    while (1) {
+        int cond = exec_node(node->cond);
+        if (break_levels > 0 || continue_levels > 0 || return_pending || interrupted) {
+            if (loop_should_stop()) {
+                break;
+            }
+            continue;
+        }
+        if ((node->type == NODE_WHILE) != (cond == 0)) {
+            break;
+        }
+        status = exec_node(node->body);
+        if (loop_should_stop()) {
+            break;
+        }
+    }
+    loop_depth--;
+    return status;
+}
+
+static int exec_if(Node *node) {
+    int cond = exec_node(node->cond);
+    if (break_levels > 0 || continue_levels > 0 || return_pending || interrupted) {
+        return cond;
+    }
+    if (cond == 0) {
+        return exec_node(node->body);
+    }
+    if (node->else_part != NULL) {
+        return exec_node(node->else_part);
+    }
+    return 0;
+}
+
+// Function to execute a parsed tree and return its exit status (also stored in $?)
+int exec_node(Node *node) {
+    static unsigned int exec_ticks = 0;
+    int status = last_status;
+
+    if (node == NULL) {
+        return status;
+    }
+    if (interrupted) {
+        last_status = 130;
+        return last_status;
+    }
+
+    // Long builtin-only loops never block in the event loop; drain captured
+    // jobs now and then so they do not stall on a full pipe, and fire any
+    // deadlines that have passed
+    if ((++exec_ticks & 1023) == 0) {
+        capture_poll();
+    }
+
+    switch (node->type) {
+    case NODE_LIST:
+        for (Node *item = node->body; item != NULL; item = item->next) {
+            status = item->background ? exec_background(item) : exec_node(item);
+            last_status = status;
+            if (break_levels > 0 || continue_levels > 0 || return_pending || interrupted) {
+                break;
+            }
+        }
+        break;
+    case NODE_AND:
+    case NODE_OR:
+        status = exec_node(node->left);
+        if (break_levels == 0 && continue_levels == 0 && !return_pending && !interrupted &&
+            ((node->type == NODE_AND) == (status == 0))) {
+            status = exec_node(node->right);
+        }
+        break;
+    case NODE_PIPELINE:
+        if (node->body->next == NULL) {
+            status = exec_node(node->body);
+        } else {
+            status = execute_pipeline(node->body);
+        }
+        if (node->negate) {
+            status = !status;
+        }
+        break;
+    case NODE_SIMPLE:
+        status = exec_simple(node, 0);
+        break;
+    case NODE_FOR:
+        status = exec_for(node);
+        break;
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        status = exec_while(node);
+        break;
+    case NODE_IF:
+        status = exec_if(node);
+        break;
+    case NODE_FUNCTION:
+        define_function(node->name, node->body);
+        status = 0;
+        break;
+    }
+
+    if (interrupted) {
+        status = 130;  // Like bash, a command line cut short by Ctrl-C reports SIGINT
+    }
+    last_status = status;
+    return status;
+}
+
+// Function to parse and run a complete piece of shell text
+int execute_command(char *input) {
+    int incomplete = 0;
+    CacheEntry *parsed = parse_cached(input, &incomplete);
+
+    if (incomplete) {
+        fprintf(stderr, "quash: syntax error: unexpected end of input\n");
+    }
+    if (parsed == NULL) {
+        last_status = 2;
+        return last_status;
+    }
+    int status = exec_node(parsed->tree);
+    release_parsed(parsed);
+    return status;
+}
+
+// Function to run an expanded argv: builtins in-process, anything else via fork/exec
+int execute_simple_command(char **args, int background) {
+    ChildSetup setup;
+    int start = parse_command_prefixes(args, &setup);
+    if (start < 0) {
+        return 2;
+    }
+
+    // Prefixed commands (even builtins) run in a child that gets the setup
+    if (start > 0) {
+        child_setup = &setup;
+        int status = execute_external_command(args + start, background);
+        child_setup = NULL;
+        return status;
+    }
+
+    builtin_status = 0;
+    if (handle_builtin_commands(args)) {
+        return builtin_status;
+    }
+    return execute_external_command(args, background);
+}
+
+// Function to remember what fd points at before a redirection replaces it
+static int save_fd(SavedFds *saved, int fd) {
+    for (int i = 0; i < saved->count; i++) {
+        if (saved->fd[i] == fd) {
+            return 0;  // Already saved by an earlier redirection
+        }
+    }
+    if (saved->count == MAX_SAVED_FDS) {
+        fprintf(stderr, "Too many redirections\n");
+        return -1;
+    }
+    saved->fd[saved->count] = fd;
+    saved->saved[saved->count] = fcntl(fd, F_DUPFD_CLOEXEC, 10);  // -1 (EBADF) if closed
+    saved->count++;
+    return 0;
+}
+
+// Function to apply redirections found in args ([N]<, [N]>, [N]>>, [N]>&M) to
+// the current process and drop them from args. With saved (builtins running in
+// the shell itself) the replaced fds are kept for restore_redirections; on
+// failure the ones already applied are undone.
+int apply_redirections(char **args, SavedFds *saved) {
+    if (saved != NULL) {
+        saved->count = 0;
+        out_flush_all();  // Output so far belongs to the old targets
+    }
+    int dst = 0;
+    for (int i = 0; args[i] != NULL; i++) {
+        const char *op = args[i];
+        int target_fd = -1;
+        int flags = 0;
+
+        // Optional leading fd number
+        const char *p = op;
+        while (isdigit((unsigned char)*p)) {
+            p++;
+        }
+        if (p != op && (*p == '<' || *p == '>')) {
+            target_fd = atoi(op);
+        }
+
+        if (strcmp(p, "<") == 0) {
+            flags = O_RDONLY;
+            if (target_fd == -1) {
+                target_fd = STDIN_FILENO;
+            }
+        } else if (strcmp(p, ">") == 0 || strcmp(p, ">>") == 0) {
+            flags = O_WRONLY | O_CREAT | (p[1] == '>' ? O_APPEND : O_TRUNC);
+            if (target_fd == -1) {
+                target_fd = STDOUT_FILENO;
+            }
+        } else if (strncmp(p, ">&", 2) == 0 && isdigit((unsigned char)p[2])) {
+            // Duplicate an existing descriptor, e.g. 2>&1
+            if (target_fd == -1) {
+                target_fd = STDOUT_FILENO;
+            }
+            if (saved != NULL && save_fd(saved, target_fd) == -1) {
+                restore_redirections(saved);
+                return -1;
+            }
+            if (dup2(atoi(p + 2), target_fd) == -1) {
+                perror("dup2");
+                if (saved != NULL) {
+                    restore_redirections(saved);
+                }
+                return -1;
+            }
+            continue;
+        } else {
+            args[dst++] = args[i];
+            continue;
+        }
+
+        if (args[i + 1] == NULL) {
+            fprintf(stderr, "No file specified for redirection\n");
+            if (saved != NULL) {
+                restore_redirections(saved);
+            }
+            return -1;
+        }
+        if (saved != NULL && save_fd(saved, target_fd) == -1) {
+            restore_redirections(saved);
+            return -1;
+        }
+        int fd = open(args[i + 1], flags, 0644);
+        if (fd == -1) {
+            perror(flags == O_RDONLY ? "Failed to open input file" : "Failed to open output file");
+            if (saved != NULL) {
+                restore_redirections(saved);
+            }
+            return -1;
+        }
+        if (fd != target_fd) {
+            dup2(fd, target_fd);
+            close(fd);
+        }
+        i++;  // Skip the file name
+    }
+    args[dst] = NULL;
+    return 0;
+}
+
+// Function to put back the fds a builtin's redirections replaced, after flushing
+// what the builtin wrote to them
+void restore_redirections(SavedFds *saved) {
+    out_flush_all();
+    for (int i = saved->count - 1; i >= 0; i--) {
+        if (saved->saved[i] == -1) {
+            close(saved->fd[i]);
+        } else {
+            dup2(saved->saved[i], saved->fd[i]);
+            close(saved->saved[i]);
+        }
+    }
+    saved->count = 0;
+}
+
+//============================================command table++++++++++++++++++++++++++++++++++++++++++++++++++++
+// A command word is resolved by name before PATH is searched. Builtins are laid
+// out at compile time by a perfect hash of their first two characters and length,
+// so finding one is a single probe plus a strcmp. Aliases and functions go in a
+// hash table that is probed first (only when it has entries), so a function may
+// shadow a builtin. A name is either an alias or a function: defining one replaces
+// the other. Function bodies are stored as parsed trees, so calls never re-tokenize.
+
+#define BUILTIN_SLOT(c0, c1, len) (((unsigned)(c0) * 4 + (unsigned)(c1) * 36 + (len)) % BUILTIN_SLOTS)
+#define BUILTIN(c0, c1, name, fn) [BUILTIN_SLOT(c0, c1, sizeof(name) - 1)] = { name, COMMAND_BUILTIN, fn }
+
+typedef enum {
+    COMMAND_BUILTIN,
+    COMMAND_ALIAS,
+    COMMAND_FUNCTION
+} CommandKind;
+
+// Function body shared by the table and every call running it
+typedef struct {
+    Node *body;
+    int refs;
+} FunctionBody;
+
+typedef struct Command {
+    const char *name;
+    CommandKind kind;
+    void (*builtin)(char **args);
+    char *alias_text;         // Alias value as it was given
+    char **alias_words;       // Its words, unexpanded (NULL-terminated)
+    int alias_word_count;
+    FunctionBody *function;
+    struct Command *next;
+} Command;
+
+Command *user_commands[USER_COMMAND_BUCKETS];  // Aliases and functions hashed by name
+int user_command_count = 0;
+
+// Function to find the link pointing at a user command (or where it would go)
+static Command **user_command_link(const char *name) {
+    Command **link = &user_commands[hash_source(name) & (USER_COMMAND_BUCKETS - 1)];
+    while (*link != NULL && strcmp((*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static void release_function(FunctionBody *function) {
+    if (function != NULL && --function->refs == 0) {
+        free_node(function->body);
+        free(function);
+    }
+}
+
+// Function to drop what a user command currently stands for
+static void user_command_clear(Command *command) {
+    for (int i = 0; i < command->alias_word_count; i++) {
+        free(command->alias_words[i]);
+    }
+    free(command->alias_words);
+    free(command->alias_text);
+    release_function(command->function);
+    command->alias_text = NULL;
+    command->alias_words = NULL;
+    command->alias_word_count = 0;
+    command->function = NULL;
+}
+
+// Function to get an empty entry for name, replacing any alias or function it had
+static Command *user_command_define(const char *name) {
+    Command **link = user_command_link(name);
+    if (*link != NULL) {
+        user_command_clear(*link);
+        return *link;
+    }
+    Command *command = calloc(1, sizeof(Command));
+    if (command == NULL) {
+        perror("calloc failed for command");
+        exit(1);
+    }
+    command->name = strdup(name);
+    *link = command;
+    user_command_count++;
+    return command;
+}
+
+// Function to remove an alias or function. Returns -1 if name is not one of kind.
+static int user_command_remove(const char *name, CommandKind kind) {
+    Command **link = user_command_link(name);
+    Command *command = *link;
+    if (command == NULL || command->kind != kind) {
+        return -1;
+    }
+    *link = command->next;
+    user_command_clear(command);
+    free((char *)command->name);
+    free(command);
+    user_command_count--;
+    return 0;
+}
+
+// Function to store a function, copying its body out of the tree being run
+void define_function(const char *name, Node *body) {
+    FunctionBody *function = malloc(sizeof(FunctionBody));
+    if (function == NULL) {
+        perror("malloc failed for function");
+        return;
+    }
+    function->body = copy_node(body);
+    function->refs = 1;
+    Command *command = user_command_define(name);
+    command->kind = COMMAND_FUNCTION;
+    command->function = function;
+}
+
+static void builtin_pwd(char **args) {
+    quash_pwd();
+}
+
+static void builtin_exit(char **args) {
+    exit(args[1] != NULL ? atoi(args[1]) : last_status); // Direct exit from shell
+}
+
+static void builtin_true(char **args) {
+}
+
+static void builtin_false(char **args) {
+    builtin_status = 1;
+}
+
+static void builtin_jobs(char **args) {
+    if (args[1] != NULL && (strcmp(args[1], "-o") == 0 || strcmp(args[1], "-f") == 0)) {
+        show_job_output(args[2], args[1][1] == 'f');
+    } else {
+        print_jobs();
+    }
+}
+
+static void builtin_export(char **args) {
+    if (args[1] != NULL) {
+        export_variable(args[1]);
+    } else {
+        out_printf(STDOUT_FILENO, "Usage: export VAR=VALUE\n");
+    }
+}
+
+static void builtin_kill(char **args) {
+    handle_kill_command(args);
+}
+
+// Builtins by BUILTIN_SLOT. Two builtins landing in one slot is a build error.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Woverride-init"
+static const Command builtin_table[BUILTIN_SLOTS] = {
+    BUILTIN(':', '\0', ":", builtin_true),
+    BUILTIN('a', 'l', "alias", quash_alias),
+    BUILTIN('b', 'g', "bg", quash_bg),
+    BUILTIN('b', 'r', "break", quash_loop_control),
+    BUILTIN('c', 'a', "cache", quash_cache),
+    BUILTIN('c', 'a', "cat", handle_cat),
+    BUILTIN('c', 'd', "cd", quash_cd),
+    BUILTIN('c', 'o', "compgen", quash_compgen),
+    BUILTIN('c', 'o', "continue", quash_loop_control),
+    BUILTIN('e', 'c', "echo", quash_echo),
+    BUILTIN('e', 'x', "exit", builtin_exit),
+    BUILTIN('e', 'x', "export", builtin_export),
+    BUILTIN('f', 'a', "false", builtin_false),
+    BUILTIN('f', 'g', "fg", quash_fg),
+    BUILTIN('g', 'r', "grep", handle_grep),
+    BUILTIN('h', 'i', "history", quash_history),
+    BUILTIN('j', 'o', "jobs", builtin_jobs),
+    BUILTIN('k', 'i', "kill", builtin_kill),
+    BUILTIN('p', 'w', "pwd", builtin_pwd),
+    BUILTIN('r', 'e', "return", quash_return),
+    BUILTIN('s', 'e', "set", quash_set),
+    BUILTIN('s', 'h', "shift", quash_shift),
+    BUILTIN('s', 'o', "sort", quash_sort),
+    BUILTIN('t', 'a', "taskset", quash_taskset),
+    BUILTIN('t', 'r', "true", builtin_true),
+    BUILTIN('t', 'y', "type", quash_type),
+    BUILTIN('u', 'l', "ulimit", quash_ulimit),
+    BUILTIN('u', 'n', "unalias", quash_unalias),
+    BUILTIN('u', 'n', "unset", quash_unset),
+};
+#pragma GCC diagnostic pop
+
+// Function to resolve a command name to an alias, function or builtin (NULL: search PATH)
+static const Command *lookup_command(const char *name) {
+    if (user_command_count > 0) {
+        Command *user = *user_command_link(name);
+        if (user != NULL) {
+            return user;
+        }
+    }
+    size_t len = strlen(name);
+    const Command *builtin = &builtin_table[BUILTIN_SLOT(name[0], len > 0 ? name[1] : 0, len)];
+    if (builtin->name != NULL && strcmp(builtin->name, name) == 0) {
+        return builtin;
+    }
+    return NULL;
+}
+
+// Function to run a function's body with args[1], args[2], ... as $1, $2, ...
+static int call_function(FunctionBody *function, char **args) {
+    if (function_depth >= MAX_FUNCTION_DEPTH) {
+        fprintf(stderr, "%s: maximum function nesting level exceeded\n", args[0]);
+        return 1;
+    }
+    char **saved_args = positional_args;
+    int saved_count = positional_count;
+    int saved_loop_depth = loop_depth;
+
+    positional_args = args + 1;
+    for (positional_count = 0; positional_args[positional_count] != NULL; positional_count++) {
+    }
+    loop_depth = 0;   // break and continue do not reach the caller's loops
+    function->refs++; // The function may be redefined while it runs
+    function_depth++;
+
+    int status = exec_node(function->body);
+
+    function_depth--;
+    return_pending = 0;
+    release_function(function);
+    loop_depth = saved_loop_depth;
+    positional_args = saved_args;
+    positional_count = saved_count;
+    return status;
+}
+
+// Function to handle built-in commands and functions (returns 1 if args[0] is one, 0 otherwise)
+int handle_builtin_commands(char **args) {
+    const Command *command = lookup_command(args[0]);
+    if (command == NULL || command->kind == COMMAND_ALIAS) {
+        return 0;
+    }
+
+    // Redirections apply to the shell itself while the builtin or function runs
+    SavedFds saved;
+    if (apply_redirections(args, &saved) == -1) {
+        builtin_status = 1;
+        return 1;
+    }
+    if (command->kind == COMMAND_FUNCTION) {
+        builtin_status = call_function(command->function, args);
+    } else {
+        command->builtin(args);
+    }
+    restore_redirections(&saved);
+    return 1;
+}
+
+// Function to check whether a simple command calls a function (its first word, unexpanded)
+int is_function_call(Node *node) {
+    if (user_command_count == 0 || node->word_count == 0) {
+        return 0;
+    }
+    Command *command = *user_command_link(node->words[0]);
+    return command != NULL && command->kind == COMMAND_FUNCTION;
+}
+
+// Function to expand a simple command's words, with a leading alias replaced by its words
+void expand_command_words(Node *node, ArgList *out) {
+    int first = 0;
+    // Only a plain word can be an alias: quoting one is the way to skip it
+    if (user_command_count > 0 && node->word_count > 0 && strpbrk(node->words[0], "'\"\\$") == NULL) {
+        Command *alias = *user_command_link(node->words[0]);
+        if (alias != NULL && alias->kind == COMMAND_ALIAS) {
+            for (int i = 0; i < alias->alias_word_count; i++) {
+                expand_word(alias->alias_words[i], out, 1);
+            }
+            first = 1;
+        }
+    }
+    for (int i = first; i < node->word_count; i++) {
+        expand_word(node->words[i], out, 1);
+    }
+}
+
+// Function to print one alias the way it can be typed back in
+static void print_alias(const Command *command) {
+    out_printf(STDOUT_FILENO, "alias %s='", command->name);
+    for (const char *c = command->alias_text; *c != '\0'; c++) {
+        if (*c == '\'') {
+            out_printf(STDOUT_FILENO, "'\\''");
+        } else {
+            out_write(STDOUT_FILENO, c, 1);
+        }
+    }
+    out_printf(STDOUT_FILENO, "'\n");
+}
+
+// Built-in function to handle 'alias [NAME[=VALUE]]...'. The value is parsed once
+// here and must be a simple command; its words replace the alias when it runs.
+void quash_alias(char **args) {
+    if (args[1] == NULL) {
+        ArgList names = {0};
+        for (int i = 0; i < USER_COMMAND_BUCKETS; i++) {
+            for (Command *command = user_commands[i]; command != NULL; command = command->next) {
+                if (command->kind == COMMAND_ALIAS) {
+                    arglist_push(&names, (char *)command->name);
+                }
+            }
+        }
+        if (names.count > 0) {
+            qsort(names.items, names.count, sizeof(char *), compare_strings);
+        }
+        for (int i = 0; i < names.count; i++) {
+            print_alias(*user_command_link(names.items[i]));
+        }
+        free(names.items);
+        return;
+    }
+
+    for (int i = 1; args[i] != NULL; i++) {
+        char *eq = strchr(args[i], '=');
+        if (eq == NULL) {
+            Command *command = *user_command_link(args[i]);
+            if (command != NULL && command->kind == COMMAND_ALIAS) {
+                print_alias(command);
+            } else {
+                fprintf(stderr, "alias: %s: not found\n", args[i]);
+                builtin_status = 1;
+            }
+            continue;
+        }
+
+        char *name = strndup(args[i], eq - args[i]);
+        int incomplete;
+        Node *tree = parse_input(eq + 1, &incomplete);
+        Node *simple = tree != NULL ? tree->body : NULL;
+        if (eq == args[i] || strchr(name, '/') != NULL) {
+            fprintf(stderr, "alias: %s: invalid alias name\n", name);
+            builtin_status = 1;
+        } else if (simple == NULL || simple->type != NODE_SIMPLE || simple->next != NULL ||
+                   simple->background) {
+            fprintf(stderr, "alias: %s: value must be a simple command\n", name);
+            builtin_status = 1;
+        } else {
+            Command *command = user_command_define(name);
+            command->kind = COMMAND_ALIAS;
+            command->alias_text = strdup(eq + 1);
+            command->alias_words = simple->words;  // Taken over from the tree
+            command->alias_word_count = simple->word_count;
+            simple->words = NULL;
+            simple->word_count = 0;
+        }
+        free_node(tree);
+        free(name);
+    }
+}
+
+// Built-in function to handle 'unalias -a' and 'unalias NAME...'
+void quash_unalias(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "Usage: unalias -a | unalias NAME...\n");
+        builtin_status = 2;
+        return;
+    }
+    if (strcmp(args[1], "-a") == 0) {
+        for (int i = 0; i < USER_COMMAND_BUCKETS; i++) {
+            Command *command = user_commands[i];
+            while (command != NULL) {
+                Command *next = command->next;
+                if (command->kind == COMMAND_ALIAS) {
+                    user_command_remove(command->name, COMMAND_ALIAS);
+                }
+                command = next;
+            }
+        }
+        return;
+    }
+    for (int i = 1; args[i] != NULL; i++) {
+        if (user_command_remove(args[i], COMMAND_ALIAS) == -1) {
+            fprintf(stderr, "unalias: %s: not found\n", args[i]);
+            builtin_status = 1;
+        }
+    }
+}
+
+// Built-in function to handle 'unset NAME...' (variables) and 'unset -f NAME...' (functions)
+void quash_unset(char **args) {
+    int functions = (args[1] != NULL && strcmp(args[1], "-f") == 0);
+    for (int i = functions ? 2 : 1; args[i] != NULL; i++) {
+        if (functions) {
+            user_command_remove(args[i], COMMAND_FUNCTION);
+        } else {
+            unset_shell_variable(args[i]);
+            unsetenv(args[i]);
+        }
+    }
+}
+
+// Function to find an executable the way execvp would. Returns 0 with its path in out.
+static int find_in_path(const char *name, StrBuf *out) {
+    const char *dir = getenv("PATH");
+    out->len = 0;
+    if (strchr(name, '/') != NULL || dir == NULL) {
+        strbuf_putn(out, name, strlen(name));
+        return access(name, X_OK) == 0 ? 0 : -1;
+    }
+    while (dir != NULL) {
+        const char *end = strchr(dir, ':');
+        size_t len = end != NULL ? (size_t)(end - dir) : strlen(dir);
+        out->len = 0;
+        strbuf_putn(out, len > 0 ? dir : ".", len > 0 ? len : 1);  // An empty entry is the cwd
+        strbuf_putn(out, "/", 1);
+        strbuf_putn(out, name, strlen(name));
+        if (access(out->data, X_OK) == 0) {
+            return 0;
+        }
+        dir = end != NULL ? end + 1 : NULL;
+    }
+    return -1;
+}
+
+// Built-in function to handle 'type NAME...': how each name would run
+void quash_type(char **args) {
+    StrBuf path = {0};
+    for (int i = 1; args[i] != NULL; i++) {
+        const Command *command = lookup_command(args[i]);
+        if (command != NULL && command->kind == COMMAND_ALIAS) {
+            out_printf(STDOUT_FILENO, "%s is aliased to '%s'\n", args[i], command->alias_text);
+        } else if (command != NULL && command->kind == COMMAND_FUNCTION) {
+            out_printf(STDOUT_FILENO, "%s is a function\n", args[i]);
+        } else if (command != NULL) {
+            out_printf(STDOUT_FILENO, "%s is a shell builtin\n", args[i]);
+        } else if (find_in_path(args[i], &path) == 0) {
+            out_printf(STDOUT_FILENO, "%s is %s\n", args[i], path.data);
+        } else {
+            fprintf(stderr, "type: %s: not found\n", args[i]);
+            builtin_status = 1;
+        }
+    }
+    free(path.data);
+}
+
+// Built-in function to handle 'return [N]': leave the running function with status N
+void quash_return(char **args) {
+    if (function_depth == 0) {
+        fprintf(stderr, "return: can only return from a function\n");
+        builtin_status = 1;
+        return;
+    }
+    builtin_status = (args[1] != NULL) ? (atoi(args[1]) & 255) : last_status;
+    return_pending = 1;
+}
+
+// Built-in function to handle 'shift [N]': drop the first N positional parameters
+void quash_shift(char **args) {
+    int n = (args[1] != NULL) ? atoi(args[1]) : 1;
+    if (n < 0 || n > positional_count) {
+        fprintf(stderr, "shift: %s: shift count out of range\n", args[1] != NULL ? args[1] : "1");
+        builtin_status = 1;
+        return;
+    }
+    positional_args += n;
+    positional_count -= n;
+}
+
+// Function to add every builtin, alias and function name starting with prefix to out
+void command_names(const char *prefix, ArgList *out) {
+    size_t len = strlen(prefix);
+    for (int i = 0; i < BUILTIN_SLOTS; i++) {
+        if (builtin_table[i].name != NULL && strncmp(builtin_table[i].name, prefix, len) == 0) {
+            arglist_push(out, strdup(builtin_table[i].name));
+        }
+    }
+    for (int i = 0; i < USER_COMMAND_BUCKETS; i++) {
+        for (Command *command = user_commands[i]; command != NULL; command = command->next) {
+            if (strncmp(command->name, prefix, len) == 0) {
+                arglist_push(out, strdup(command->name));
+            }
+        }
+    }
+}
+
+
+// Built-in function to handle 'pwd' command
+void quash_pwd() {
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        out_printf(STDOUT_FILENO, "%s\n", cwd);
+    } else {
+        perror("getcwd() error");
+        builtin_status = 1;
+    }
+}
+
+
+// Built-in function to handle 'echo' command ($VAR and quotes are already expanded)
+void quash_echo(char **args) {
+    // Redirections were applied by handle_builtin_commands, so stdout is the target
+    for (int i = 1; args[i] != NULL; i++) {
+        out_write(STDOUT_FILENO, args[i], strlen(args[i]));
+        if (args[i + 1] != NULL) {
+            out_write(STDOUT_FILENO, " ", 1);  // Add space between arguments
+        }
+    }
+    out_write(STDOUT_FILENO, "\n", 1);
+}
+
+
+// Built-in function to handle 'cd' command
+void quash_cd(char **args) {
+    if (args[1] == NULL || strcmp(args[1], "~") == 0) {
+        char *home = getenv("HOME");
+        if (home == NULL) {
+            fprintf(stderr, "HOME not set\n");
+            builtin_status = 1;
+        } else if (chdir(home) != 0) {
+            perror("chdir");
+            builtin_status = 1;
+        }
+    } else if (strcmp(args[1], "..") == 0) {
+        if (chdir("..") != 0) {
+            perror("chdir");
+            builtin_status = 1;
+        }
+    } else {
+        if (chdir(args[1]) != 0) {
+            perror("chdir");
+            builtin_status = 1;
+        }
+    }
+}
+
+// Function to execute external commands (returns the exit status, 0 for background jobs)
+int execute_external_command(char **args, int background) {
+    int capture_fds[2];
+    int capturing = background && capture_begin(capture_fds) == 0;
+    int timed = (child_setup != NULL && child_setup->timeout_ms > 0);
+    pid_t group = job_group_for(background);
+    if (timed && group == -1 && job_control) {
+        group = 0;  // So the deadline reaches everything the command starts (as coreutils timeout does);
+                    // without job control the command must stay in the terminal's foreground group
+    }
+    pid_t pid = fork_job(group, !background && job_control);
+    
+    if (pid == 0) {  // Child process
+        if (capturing) {
+            capture_child(capture_fds);
+        }
+        if (apply_child_setup(child_setup) == -1) {
+            _exit(126);
+        }
+        exec_args_in_child(args);
+    } else if (pid < 0) {
+        perror("fork failed");
+        if (capturing) {
+            close(capture_fds[0]);
+            close(capture_fds[1]);
+        }
+        return 1;
+    } else {  // Parent process
+        if (background) {
+            add_job(pid, args[0]);
+            if (capturing) {
+                capture_attach(capture_fds);
+            }
+            arm_job_deadline(child_setup);
+            
+            if (!rc_running) {
+                out_printf(STDOUT_FILENO, "Background job started: [%d] %d %s\n", last_job_id, pid, args[0]);
+            }
+        } else {
+            // Wait for foreground process to finish (captured jobs keep draining meanwhile)
+            if (!timed) {
+                return wait_for_foreground(&pid, 1, args[0]);
+            }
+            int timer = deadline_start(group == 0 ? -pid : pid, 0, child_setup->timeout_ms,
+                                       child_setup->timeout_signal, child_setup->grace_ms);
+            int jobs_before = job_count;
+            int status = wait_for_foreground(&pid, 1, args[0]);
+            if (job_count > jobs_before) {
+                deadline_attach(timer, last_job_id);  // Stopped: the job keeps its deadline
+                return status;
+            }
+            // Like coreutils timeout: 124 when the command was stopped by the deadline
+            return deadline_cancel(timer) == 1 ? 124 : status;
+        }
+    }
+    return 0;
+}
+
+// Built-in function to handle 'break [N]' and 'continue [N]'
+void quash_loop_control(char **args) {
+    int levels = (args[1] != NULL) ? atoi(args[1]) : 1;
+
+    if (loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", args[0]);
+        builtin_status = 1;
+        return;
+    }
+    if (levels < 1) {
+        fprintf(stderr, "%s: %s: loop count out of range\n", args[0], args[1]);
+        builtin_status = 1;
+        return;
+    }
+    if (levels > loop_depth) {
+        levels = loop_depth;
+    }
+    if (strcmp(args[0], "break") == 0) {
+        break_levels = levels;
+    } else {
+        continue_levels = levels;
+    }
+}
+
+// Function to add a job to the job list
+void add_job(pid_t pid, char *command) {
+    // Grow the job table when it fills up
+    if (job_count == job_capacity) {
+        int new_capacity = job_capacity ? job_capacity * 2 : JOB_TABLE_INITIAL;
+        Job *grown = realloc(jobs, new_capacity * sizeof(Job));
+        if (grown != NULL) {
+            jobs = grown;
+            job_capacity = new_capacity;
+        }
+    }
+
+    if (job_count < job_capacity) {
+        jobs[job_count].job_id = ++last_job_id;
+        jobs[job_count].pid = pid;
+        strncpy(jobs[job_count].command, command, MAX_INPUT_SIZE - 1);
+        jobs[job_count].command[MAX_INPUT_SIZE - 1] = '\0';
+        jobs[job_count].pgid = (getpgid(pid) != getpgrp()) ? getpgid(pid) : 0;
+        jobs[job_count].active = 1;
+        jobs[job_count].stopped = 0;
+        jobs[job_count].timed_out = 0;
+        jobs[job_count].exit_status = 0;
+        jobs[job_count].captured = 0;
+        jobs[job_count].capture_fd = -1;
+        memset(&jobs[job_count].output, 0, sizeof(OutputRing));
+        
+       // printf("Job added successfully. Job ID = %d, PID = %d, Command = %s\n", 
+               //jobs[job_count].job_id, jobs[job_count].pid, jobs[job_count].command);  // Confirm job details
+        
+        job_count++;
+    } else {
+        out_printf(STDOUT_FILENO, "Failed to add job: Out of memory for job table\n");
+    }
+}
+// Function to collect finished background jobs and remember how they ended
+void reap_jobs() {
+    for (int i = 0; i < job_count; i++) {
+        if (!jobs[i].active) {
+            continue;
+        }
+        // A job is finished once no process of its group is left
+        pid_t target = jobs[i].pgid > 0 ? -jobs[i].pgid : jobs[i].pid;
+        int status;
+        pid_t result;
+        while ((result = waitpid(target, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+            if (WIFSTOPPED(status)) {
+                jobs[i].stopped = 1;
+            } else if (WIFCONTINUED(status)) {
+                jobs[i].stopped = 0;
+            } else if (result == jobs[i].pid) {
+                jobs[i].exit_status = status;
+            }
+        }
+        if (result == -1 && errno == ECHILD) {
+            jobs[i].active = 0;
+            cancel_job_deadline(jobs[i].job_id);
+        }
+    }
+}
+
+// Function to print currently running jobs
+void print_jobs() {
+    int jobs_found = 0;  // Track if any job exists
+
+    capture_poll();  // Pick up output written since the last prompt
+    reap_jobs();
+
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].active && jobs[i].stopped) {
+            out_printf(STDOUT_FILENO, "[%d] %d %s - Stopped\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
+        } else if (jobs[i].active) {
+            out_printf(STDOUT_FILENO, "[%d] %d %s - Running\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
+        } else if (jobs[i].timed_out) {
+            out_printf(STDOUT_FILENO, "[%d] %d %s - Timed out (status %d)\n", jobs[i].job_id, jobs[i].pid, jobs[i].command, status_from_wait(jobs[i].exit_status));
+        } else if (WIFSIGNALED(jobs[i].exit_status)) {
+            out_printf(STDOUT_FILENO, "[%d] %d %s - Terminated by signal %d\n", jobs[i].job_id, jobs[i].pid, jobs[i].command, WTERMSIG(jobs[i].exit_status));
+        } else if (WEXITSTATUS(jobs[i].exit_status) != 0) {
+            out_printf(STDOUT_FILENO, "[%d] %d %s - Exited with status %d\n", jobs[i].job_id, jobs[i].pid, jobs[i].command, WEXITSTATUS(jobs[i].exit_status));
+        } else {
+            out_printf(STDOUT_FILENO, "[%d] %d %s - Completed\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
+        }
+        jobs_found = 1;
+        if (jobs[i].captured) {
+            out_printf(STDOUT_FILENO, "    %llu bytes of output (jobs -o %%%d)\n", jobs[i].output.total, jobs[i].job_id);
+        }
+    }
+
+    if (!jobs_found) {
+        out_printf(STDOUT_FILENO, "No jobs found\n");
+    }
+}
+// Function to check for completed background jobs
+void check_background_jobs() {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].active) {
+            int status;
+            pid_t result = waitpid(jobs[i].pid, &status, WNOHANG);  // Check if the job has finished
+            if (result == 0) {
+                // The job is still running (waitpid returns 0)
+                continue;
+            } else if (result == jobs[i].pid) {
+                // The job has finished (waitpid returns the PID)
+                out_printf(STDOUT_FILENO, "Completed: [%d] %d %s\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
+                jobs[i].active = 0;  // Mark the job as inactive
+            } else if (result == -1) {
+                // An error occurred (this shouldn't usually happen unless the job doesn't exist)
+                perror("waitpid");
+            }
+        }
+    }
+}
+
+// Function to remove a job from the job list (not used but could be useful)
+// Function to remove a job from the job list by marking it inactive
+// Function to remove a job from the job list by marking it inactive
+void remove_job(pid_t pid) {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].pid == pid) {
+            jobs[i].active = 0;
+            break;
+        }
+    }
+}
+
+// Function to take a finished job out of the table and free its captured output.
+// Later jobs keep their ids.
+void drop_job(Job *job) {
+    free(job->output.data);
+    size_t index = job - jobs;
+    memmove(job, job + 1, (job_count - index - 1) * sizeof(Job));
+    job_count--;
+}
+//============================================timeouts++++++++++++++++++++++++++++++++++++++++++++++++++++
+// 'timeout DURATION cmd' and 'set -o deadline=DURATION' (every background job)
+// are enforced by timerfds in the event loop; nothing extra is forked. When a
+// deadline passes the job's process group gets its signal (SIGTERM by default),
+// then SIGKILL once the grace period ('set -o killgrace=DURATION', 'timeout -k')
+// is over, unless it exited in between.
+
+typedef struct {
+    int fd;          // timerfd
+    pid_t target;    // pid, or -pgid to reach the whole job
+    int job_id;      // Job to mark as timed out, 0 for a foreground command
+    int signal;      // Sent when the deadline passes
+    long grace_ms;   // Then SIGKILL after this long; 0 = never
+    int fired;       // Signals sent so far
+} Deadline;
+
+Deadline *deadlines = NULL;
+int deadline_count = 0;
+int deadline_capacity = 0;
+
+static const struct {
+    const char *name;
+    int signal;
+} signal_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "TERM", SIGTERM }, { "ALRM", SIGALRM },
+    { NULL, 0 }
+};
+
+// Function to parse a signal given as a number, "TERM" or "SIGTERM"
+int parse_signal(const char *text) {
+    if (isdigit((unsigned char)text[0])) {
+        int sig = atoi(text);
+        return (sig > 0 && sig < NSIG) ? sig : -1;
+    }
+    if (strncmp(text, "SIG", 3) == 0) {
+        text += 3;
+    }
+    for (int i = 0; signal_names[i].name != NULL; i++) {
+        if (strcasecmp(text, signal_names[i].name) == 0) {
+            return signal_names[i].signal;
+        }
+    }
+    return -1;
+}
+
+// Function to parse a duration such as "90", "1.5s", "250ms", "10m", "2h" or "1d"
+// into milliseconds (plain numbers are seconds)
+int parse_duration(const char *text, long *ms) {
+    char *end;
+    errno = 0;
+    double n = strtod(text, &end);
+    if (end == text || errno != 0 || n < 0) {
+        return -1;
+    }
+    double scale = 1000;
+    if (strcmp(end, "ms") == 0) {
+        scale = 1;
+    } else if (strcmp(end, "m") == 0) {
+        scale = 60 * 1000;
+    } else if (strcmp(end, "h") == 0) {
+        scale = 3600 * 1000;
+    } else if (strcmp(end, "d") == 0) {
+        scale = 86400 * 1000;
+    } else if (*end != '\0' && strcmp(end, "s") != 0) {
+        return -1;
+    }
+    *ms = (long)(n * scale + 0.5);
+    return 0;
+}
+
+// Function to print a duration in the unit it was most likely given in
+void format_duration(long ms, char *buf, size_t size) {
+    if (ms % 3600000 == 0 && ms > 0) {
+        snprintf(buf, size, "%ldh", ms / 3600000);
+    } else if (ms % 60000 == 0 && ms > 0) {
+        snprintf(buf, size, "%ldm", ms / 60000);
+    } else if (ms % 1000 == 0) {
+        snprintf(buf, size, "%lds", ms / 1000);
+    } else {
+        snprintf(buf, size, "%ldms", ms);
+    }
+}
+
+// Function to tell whether any deadline is still waiting to fire
+int deadlines_pending() {
+    return deadline_count > 0;
+}
+
+static Deadline *find_deadline(int fd) {
+    for (int i = 0; i < deadline_count; i++) {
+        if (deadlines[i].fd == fd) {
+            return &deadlines[i];
+        }
+    }
+    return NULL;
+}
+
+static void arm_timer(int fd, long ms) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    if (ms == 0) {
+        spec.it_value.tv_nsec = 1;  // Zero would disarm the timer
+    }
+    timerfd_settime(fd, 0, &spec, NULL);
+}
+
+static void deadline_expired(int fd, void *ctx) {
+    uint64_t expirations;
+    Deadline *deadline = find_deadline(fd);
+    (void)ctx;
+
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations) || deadline == NULL) {
+        return;
+    }
+    if (deadline->fired == 0) {
+        kill(deadline->target, deadline->signal);
+        kill(deadline->target, SIGCONT);  // A stopped job could not act on it
+        Job *job = find_job(deadline->job_id);
+        if (job != NULL) {
+            job->timed_out = 1;
+        }
+        deadline->fired = 1;
+        if (deadline->grace_ms > 0 && deadline->signal != SIGKILL) {
+            arm_timer(fd, deadline->grace_ms);
+        }
+    } else {
+        kill(deadline->target, SIGKILL);
+        deadline->fired = 2;
+    }
+}
+
+// Function to start a deadline for target (see Deadline). Returns the timerfd, or -1.
+int deadline_start(pid_t target, int job_id, long ms, int sig, long grace_ms) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        perror("timerfd_create");
+        return -1;
+    }
+    if (deadline_count == deadline_capacity) {
+        deadline_capacity = deadline_capacity ? deadline_capacity * 2 : 16;
+        deadlines = realloc(deadlines, deadline_capacity * sizeof(Deadline));
+        if (deadlines == NULL) {
+            perror("realloc failed for deadlines");
+            exit(1);
+        }
+    }
+    Deadline *deadline = &deadlines[deadline_count++];
+    deadline->fd = fd;
+    deadline->target = target;
+    deadline->job_id = job_id;
+    deadline->signal = sig;
+    deadline->grace_ms = grace_ms;
+    deadline->fired = 0;
+
+    arm_timer(fd, ms);
+    event_add(fd, deadline_expired, NULL);
+    return fd;
+}
+
+// Function to stop a deadline. Returns how many signals it had sent.
+int deadline_cancel(int fd) {
+    Deadline *deadline = find_deadline(fd);
+    if (deadline == NULL) {
+        return 0;
+    }
+    int fired = deadline->fired;
+    event_remove(fd);
+    close(fd);
+    *deadline = deadlines[--deadline_count];
+    return fired;
+}
+
+// Function to hand a deadline over to a job (a timed command that got stopped)
+void deadline_attach(int fd, int job_id) {
+    Deadline *deadline = find_deadline(fd);
+    if (deadline != NULL) {
+        deadline->job_id = job_id;
+    }
+}
+
+// Function to drop the deadline of a job that has finished
+void cancel_job_deadline(int job_id) {
+    for (int i = 0; i < deadline_count; i++) {
+        if (deadlines[i].job_id == job_id) {
+            deadline_cancel(deadlines[i].fd);
+            return;
+        }
+    }
+}
+
+// Function to put the newest job under its deadline: the command's own
+// 'timeout', or else the shell-wide 'set -o deadline'
+void arm_job_deadline(const ChildSetup *setup) {
+    Job *job = find_job(last_job_id);
+    if (job == NULL) {
+        return;
+    }
+    pid_t target = job->pgid > 0 ? -job->pgid : job->pid;
+    if (setup != NULL && setup->timeout_ms < 0) {
+        return;  // 'timeout 0': explicitly unlimited
+    }
+    if (setup != NULL && setup->timeout_ms > 0) {
+        deadline_start(target, job->job_id, setup->timeout_ms, setup->timeout_signal, setup->grace_ms);
+    } else if (opt_deadline_ms > 0) {
+        deadline_start(target, job->job_id, opt_deadline_ms, SIGTERM, opt_kill_grace_ms);
+    }
+}
+
+// Function to reset deadline bookkeeping in a forked child (timers are closed with
+// the other event sources)
+void reset_child_deadlines() {
+    deadline_count = 0;
+}
+
+//============================================job control++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Every job runs in its own process group, so 'kill %N' and Ctrl-C/Ctrl-Z reach
+// all of its processes. When the shell owns a terminal, the foreground job gets
+// the terminal with tcsetpgrp and gives it back when it exits or stops.
+
+// Function to take over the terminal for an interactive shell
+static void sigint_handler(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+void init_job_control() {
+    // Wait until we are the foreground job of whoever started us
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+
+    // Keyboard signals are for the foreground job, not for us. Ctrl-C while the
+    // shell itself is the foreground job (a builtin-only loop) stops the command line.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    if (getpid() != shell_pgid && setpgid(0, 0) == -1) {
+        perror("setpgid");
+        return;
+    }
+    shell_pgid = getpid();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_control = 1;
+}
+
+// Function to choose the process group for a new command (see fork_job):
+// background jobs always get their own, foreground ones only with a terminal
+pid_t job_group_for(int background) {
+    if (in_subshell) {
+        return -1;  // Stay in the enclosing job's group
+    }
+    return (background || job_control) ? 0 : -1;
+}
+
+// Function to find the pid (or negated group) that reaches every process of a job
+static pid_t job_target(Job *job) {
+    return job->pgid > 0 ? -job->pgid : job->pid;
+}
+
+// Function to wait for a foreground command or pipeline, given the pids of its
+// processes (0 for stages that never started). If it is stopped (Ctrl-Z) it
+// becomes a Stopped job and 128 + the stop signal is returned.
+int wait_for_foreground(pid_t *pids, int count, const char *label) {
+    int status = 0;
+    int remaining = 0;
+    int stop_signal = 0;
+
+    for (int i = 0; i < count; i++) {
+        remaining += (pids[i] > 0);
+    }
+    while (remaining > 0 && stop_signal == 0) {
+        int progress = 0;
+        for (int i = 0; i < count && stop_signal == 0; i++) {
+            if (pids[i] <= 0) {
+                continue;
+            }
+            int wstatus;
+            pid_t result = waitpid(pids[i], &wstatus, WNOHANG | WUNTRACED);
+            if (result == pids[i] && WIFSTOPPED(wstatus)) {
+                stop_signal = WSTOPSIG(wstatus);
+            } else if (result == pids[i] || (result == -1 && errno == ECHILD)) {
+                if (i == count - 1 && result == pids[i]) {
+                    status = status_from_wait(wstatus);
+                }
+                if (job_control && result == pids[i] && WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGINT) {
+                    interrupted = 1;  // Ctrl-C on a command inside a loop stops the loop too
+                }
+                pids[i] = 0;
+                remaining--;
+                progress = 1;
+            }
+        }
+        if (remaining > 0 && stop_signal == 0 && !progress) {
+            event_loop_once(-1, -1);  // SIGCHLD (exit or stop) will wake us up
+        }
+    }
+
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+    if (stop_signal == 0) {
+        return status;
+    }
+
+    // Track it from the last stage still alive, so its exit status is kept
+    pid_t job_pid = 0;
+    for (int i = 0; i < count; i++) {
+        if (pids[i] > 0) {
+            job_pid = pids[i];
+        }
+    }
+    add_job(job_pid, (char *)label);
+    jobs[job_count - 1].stopped = 1;
+    out_printf(STDOUT_FILENO, "\n[%d] %d %s - Stopped\n", last_job_id, job_pid, label);
+    return 128 + stop_signal;
+}
+
+// Function to wait in the foreground for every process of a job. Returns the
+// job's status, or 128 + the stop signal if it was stopped again.
+int wait_for_job(Job *job) {
+    while (1) {
+        int wstatus;
+        pid_t result = waitpid(job_target(job), &wstatus, WNOHANG | WUNTRACED);
+        if (result > 0) {
+            if (WIFSTOPPED(wstatus)) {
+                job->stopped = 1;
+                return 128 + WSTOPSIG(wstatus);
+            }
+            if (result == job->pid) {
+                job->exit_status = wstatus;
+            }
+        } else if (result == 0) {
+            event_loop_once(-1, -1);
+        } else if (errno != EINTR) {
+            job->active = 0;  // No process of the job is left
+            cancel_job_deadline(job->job_id);
+            return status_from_wait(job->exit_status);
+        }
+    }
+}
+
+// Function to pick the job named by '%N', or the most recent live one
+static Job *job_from_spec(const char *spec, const char *builtin) {
+    reap_jobs();
+    if (spec == NULL) {
+        for (int i = job_count - 1; i >= 0; i--) {
+            if (jobs[i].active) {
+                return &jobs[i];
+            }
+        }
+        fprintf(stderr, "%s: no current job\n", builtin);
+        return NULL;
+    }
+    Job *job = find_job(atoi(spec[0] == '%' ? spec + 1 : spec));
+    if (job == NULL || !job->active) {
+        fprintf(stderr, "%s: %s: no such job\n", builtin, spec);
+        return NULL;
+    }
+    return job;
+}
+
+// Built-in function to handle 'fg [%N]': continue a job in the foreground
+void quash_fg(char **args) {
+    Job *job = job_from_spec(args[1], "fg");
+    if (job == NULL) {
+        builtin_status = 1;
+        return;
+    }
+
+    out_printf(STDOUT_FILENO, "%s\n", job->command);
+    out_flush_all();
+    if (job_control && job->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    kill(job_target(job), SIGCONT);
+    job->stopped = 0;
+
+    builtin_status = wait_for_job(job);
+    if (job_control) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+    if (job->stopped) {
+        out_printf(STDOUT_FILENO, "\n[%d] %d %s - Stopped\n", job->job_id, job->pid, job->command);
+    }
+}
+
+// Built-in function to handle 'bg [%N]': continue a stopped job in the background
+void quash_bg(char **args) {
+    Job *job = job_from_spec(args[1], "bg");
+    if (job == NULL) {
+        builtin_status = 1;
+        return;
+    }
+    if (kill(job_target(job), SIGCONT) == -1) {
+        perror("bg");
+        builtin_status = 1;
+        return;
+    }
+    job->stopped = 0;
+    out_printf(STDOUT_FILENO, "[%d] %d %s &\n", job->job_id, job->pid, job->command);
+}
+
+//============================================daemon mode++++++++++++++++++++++++++++++++++++++++++++++++++++
+// 'quash --daemon --socket PATH' serves many clients from one process. Each client
+// sends newline-terminated requests over a Unix stream socket:
+//
+//   run COMMAND     start COMMAND as a captured background job. Replies
+//                   'started JOB PID', then 'output JOB LEN' + LEN bytes as the job
+//                   writes, then 'exit JOB STATUS'.
+//   quit            close the connection.
+//   anything else   run COMMAND and reply 'result STATUS LEN' + LEN bytes of
+//                   output. Commands made only of builtins that change or report
+//                   the daemon's own state (cd, export, jobs, kill %N, ...) run in
+//                   the daemon so they take effect there; the rest run in a
+//                   forked child, and the reply is sent when it exits.
+//                   'exit' is one of the rest: it ends that child, never the
+//                   daemon.
+//
+// Stopping the daemon is left to whoever runs it: SIGTERM or SIGINT ends the
+// loop, and the socket is removed on the way out.
+//
+// Clients are multiplexed through the event loop: their sockets are event
+// sources, and requests are only run from the top of the daemon loop, never from
+// inside a nested wait, so one client's command cannot interleave with another's.
+// Client sockets are non-blocking: replies a client is not reading yet wait in
+// its queue, and no new output or request is taken for it until that drains.
+
+typedef struct {
+    int fd;
+    StrBuf in;     // Received bytes not yet turned into requests
+    StrBuf out;    // Reply bytes the socket has not taken yet
+    int closed;    // Peer went away; freed at the top of the loop
+    pid_t request_pid;  // Child running the client's current request, 0 if none
+    int request_fd;     // memfd collecting that child's output
+} DaemonClient;
+
+// Captured job whose output is streamed to a client
+typedef struct {
+    int client_fd;
+    int job_id;
+    unsigned long long sent;   // Ring offset already sent
+} DaemonFollow;
+
+DaemonClient *daemon_clients = NULL;
+int daemon_client_count = 0;
+int daemon_client_capacity = 0;
+DaemonFollow *daemon_follows = NULL;
+int daemon_follow_count = 0;
+int daemon_follow_capacity = 0;
+const char *daemon_socket_path = NULL;
+volatile sig_atomic_t daemon_stop = 0;  // SIGTERM or SIGINT asked the daemon to shut down
+
+static DaemonClient *find_client(int fd) {
+    for (int i = 0; i < daemon_client_count; i++) {
+        if (daemon_clients[i].fd == fd) {
+            return &daemon_clients[i];
+        }
+    }
+    return NULL;
+}
+
+static void daemon_client_gone(DaemonClient *client) {
+    client->closed = 1;
+    event_remove(client->fd);
+}
+
+// Function to send queued reply bytes once the client's socket has room again
+static void daemon_client_write(int fd, void *ctx) {
+    DaemonClient *client = find_client(fd);
+    (void)ctx;
+
+    size_t sent = 0;
+    while (sent < client->out.len) {
+        ssize_t n = send(fd, client->out.data + sent, client->out.len - sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN) {
+            break;
+        }
+        if (n == -1) {
+            daemon_client_gone(client);
+            return;
+        }
+        sent += n;
+    }
+    memmove(client->out.data, client->out.data + sent, client->out.len - sent);
+    client->out.len -= sent;
+    if (client->out.len == 0) {
+        event_want_write(fd, NULL);
+    }
+}
+
+// Function to send a reply header and optional payload. As much as the socket
+// takes goes out in one system call; the rest is queued for daemon_client_write.
+static void daemon_send(DaemonClient *client, const char *header, const char *data, size_t len) {
+    size_t header_len = strlen(header);
+    size_t sent = 0;
+    if (client->closed) {
+        return;
+    }
+
+    if (client->out.len == 0) {
+        struct iovec iov[2] = {
+            { (void *)header, header_len },
+            { (void *)data, len },
+        };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = len > 0 ? 2 : 1;
+        ssize_t n;
+        do {
+            n = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1 && errno != EAGAIN) {
+            daemon_client_gone(client);
+            return;
+        }
+        sent = n > 0 ? n : 0;
+    }
+
+    if (sent < header_len) {
+        strbuf_putn(&client->out, header + sent, header_len - sent);
+        sent = 0;
+    } else {
+        sent -= header_len;
+    }
+    if (sent < len) {
+        strbuf_putn(&client->out, data + sent, len - sent);
+    }
+    if (client->out.len > 0) {
+        event_want_write(client->fd, daemon_client_write);
+    }
+}
+
+static void daemon_client_read(int fd, void *ctx) {
+    DaemonClient *client = find_client(fd);
+    char buf[4096];
+    (void)ctx;
+
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n > 0) {
+        strbuf_putn(&client->in, buf, n);
+    } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+        daemon_client_gone(client);
+    }
+}
+
+static void daemon_accept(int fd, void *ctx) {
+    (void)ctx;
+    while (1) {
+        int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("accept");
+            }
+            return;
+        }
+        if (daemon_client_count == daemon_client_capacity) {
+            daemon_client_capacity = daemon_client_capacity ? daemon_client_capacity * 2 : 16;
+            daemon_clients = realloc(daemon_clients, daemon_client_capacity * sizeof(DaemonClient));
+            if (daemon_clients == NULL) {
+                perror("realloc failed for daemon clients");
+                exit(1);
+            }
+        }
+        DaemonClient *client = &daemon_clients[daemon_client_count++];
+        memset(client, 0, sizeof(*client));
+        client->fd = client_fd;
+        event_add(client_fd, daemon_client_read, NULL);
+    }
+}
+
+static void daemon_follow(DaemonClient *client, int job_id) {
+    if (daemon_follow_count == daemon_follow_capacity) {
+        daemon_follow_capacity = daemon_follow_capacity ? daemon_follow_capacity * 2 : 16;
+        daemon_follows = realloc(daemon_follows, daemon_follow_capacity * sizeof(DaemonFollow));
+        if (daemon_follows == NULL) {
+            perror("realloc failed for daemon follows");
+            exit(1);
+        }
+    }
+    daemon_follows[daemon_follow_count].client_fd = client->fd;
+    daemon_follows[daemon_follow_count].job_id = job_id;
+    daemon_follows[daemon_follow_count].sent = 0;
+    daemon_follow_count++;
+}
+
+// Function to start 'run' requests: a captured background job, registered with
+// add_job like any other. A single simple command is exec'd without a subshell.
+static void daemon_run(DaemonClient *client, const char *command) {
+    int incomplete = 0;
+    CacheEntry *parsed = parse_cached(command, &incomplete);
+    if (parsed == NULL) {
+        daemon_send(client, incomplete ? "error incomplete command\n" : "error syntax error\n", NULL, 0);
+        return;
+    }
+
+    Node *node = parsed->tree;
+    if (node->body != NULL && node->body->next == NULL && !node->body->background &&
+        node->body->type == NODE_PIPELINE && node->body->body->next == NULL && !node->body->negate) {
+        node = node->body->body;
+    }
+
+    int capture_fds[2];
+    int saved_capture = opt_capture;
+    opt_capture = 1;
+    int capturing = (capture_begin(capture_fds) == 0);
+    opt_capture = saved_capture;
+
+    pid_t pid = fork_job(job_group_for(1), 0);
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+        if (capturing) {
+            capture_child(capture_fds);
+        }
+        exec_pipeline_stage(node);
+    }
+    release_parsed(parsed);
+    if (pid < 0) {
+        perror("fork failed");
+        if (capturing) {
+            close(capture_fds[0]);
+            close(capture_fds[1]);
+        }
+        daemon_send(client, "error fork failed\n", NULL, 0);
+        return;
+    }
+
+    add_job(pid, (char *)command);
+    if (capturing) {
+        capture_attach(capture_fds);
+    }
+    arm_job_deadline(NULL);
+
+    char header[64];
+    snprintf(header, sizeof(header), "started %d %d\n", last_job_id, pid);
+    daemon_send(client, header, NULL, 0);
+    daemon_follow(client, last_job_id);
+}
+
+// Builtins that only change or report the daemon's own state and never wait on
+// a process. Requests made of nothing else run in the daemon itself.
+static const char *daemon_local_builtins[] = {
+    ":", "alias", "bg", "cache", "cd", "compgen", "echo", "export", "false",
+    "history", "jobs", "kill", "pwd", "set", "true", "type", "ulimit", "unalias", "unset", NULL
+};
+
+// Function to check whether a request can run inside the daemon: a list of
+// assignments, function definitions and local builtins, none in the background
+static int daemon_request_is_local(Node *tree) {
+    Node *item = tree->type == NODE_LIST ? tree->body : tree;
+    for (; item != NULL; item = item->next) {
+        if (item->background) {
+            return 0;
+        }
+        if (item->type == NODE_FUNCTION || (item->type == NODE_SIMPLE && is_assignment_only(item))) {
+            continue;
+        }
+        if (item->type != NODE_SIMPLE || item->word_count == 0 ||
+            strpbrk(item->words[0], "'\"\\$") != NULL) {
+            return 0;
+        }
+        const Command *command = lookup_command(item->words[0]);
+        if (command == NULL || command->kind != COMMAND_BUILTIN) {
+            return 0;
+        }
+        int local = 0;
+        for (int i = 0; daemon_local_builtins[i] != NULL; i++) {
+            if (strcmp(item->words[0], daemon_local_builtins[i]) == 0) {
+                local = 1;
+            }
+        }
+        for (int i = 1; i < item->word_count; i++) {
+            if (strcmp(item->words[0], "jobs") == 0 && strcmp(item->words[i], "-f") == 0) {
+                local = 0;  // Following a job's output waits for it to end
+            }
+        }
+        if (!local) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to send a 'result' reply with the output collected in reply_fd, then close it
+static void daemon_send_result(DaemonClient *client, int status, int reply_fd) {
+    off_t size = lseek(reply_fd, 0, SEEK_END);
+    char *data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, reply_fd, 0) : NULL;
+    if (data == MAP_FAILED) {
+        data = NULL;
+        size = 0;
+    }
+    char header[64];
+    snprintf(header, sizeof(header), "result %d %lld\n", status, (long long)(data ? size : 0));
+    daemon_send(client, header, data, data ? size : 0);
+    if (data != NULL) {
+        munmap(data, size);
+    }
+    close(reply_fd);
+}
+
+// Function to run a request that is not 'run' and send back what it printed.
+// Local requests finish here; anything else is left running in a child that
+// daemon_finish_requests answers for once it exits.
+static void daemon_run_inline(DaemonClient *client, const char *command) {
+    int reply_fd = memfd_create("quash-reply", MFD_CLOEXEC);
+    if (reply_fd == -1) {
+        daemon_send(client, "error memfd_create failed\n", NULL, 0);
+        return;
+    }
+
+    // Point stdout and stderr at the reply buffer while the command runs or starts
+    out_flush_all();
+    fflush(NULL);
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+    dup2(reply_fd, STDOUT_FILENO);
+    dup2(reply_fd, STDERR_FILENO);
+
+    pid_t pid = 0;
+    int incomplete = 0;
+    CacheEntry *parsed = parse_cached(command, &incomplete);
+    if (parsed != NULL && daemon_request_is_local(parsed->tree)) {
+        exec_node(parsed->tree);
+    } else if (parsed != NULL) {
+        pid = quash_fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_RDONLY);
+            if (null_fd != -1) {
+                dup2(null_fd, STDIN_FILENO);
+                close(null_fd);
+            }
+            int status = exec_node(parsed->tree);
+            out_flush_all();
+            _exit(status);
+        } else if (pid < 0) {
+            perror("fork failed");
+            last_status = 1;
+        }
+    } else {
+        if (incomplete) {
+            fprintf(stderr, "quash: incomplete command\n");
+        }
+        last_status = 2;
+    }
+    if (parsed != NULL) {
+        release_parsed(parsed);
+    }
+
+    out_flush_all();
+    fflush(NULL);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    if (pid > 0) {
+        client->request_pid = pid;
+        client->request_fd = reply_fd;
+        return;
+    }
+    daemon_send_result(client, last_status, reply_fd);
+}
+
+// Function to answer clients whose request child has exited
+static void daemon_finish_requests() {
+    for (int i = 0; i < daemon_client_count; i++) {
+        DaemonClient *client = &daemon_clients[i];
+        int status;
+        if (client->request_pid == 0) {
+            continue;
+        }
+        pid_t result = waitpid(client->request_pid, &status, WNOHANG);
+        if (result == 0 || (result == -1 && errno == EINTR)) {
+            continue;
+        }
+        client->request_pid = 0;
+        if (result == -1) {
+            status = 127 << 8;  // Collected elsewhere; nothing better to report
+        }
+        if (client->closed) {
+            close(client->request_fd);
+        } else {
+            daemon_send_result(client, status_from_wait(status), client->request_fd);
+        }
+    }
+}
+
+// Function to send new output and exit statuses of followed jobs
+static void daemon_stream_jobs() {
+    reap_jobs();
+    for (int i = 0; i < daemon_follow_count; i++) {
+        DaemonFollow *follow = &daemon_follows[i];
+        DaemonClient *client = find_client(follow->client_fd);
+        Job *job = find_job(follow->job_id);
+        char header[96];
+
+        if (client != NULL && client->out.len > 0) {
+            continue;  // Not reading yet: the ring holds on to the output meanwhile
+        }
+        if (client != NULL && !client->closed) {
+            OutputRing *ring = &job->output;
+            unsigned long long oldest = ring->total > ring->alloc ? ring->total - ring->alloc : 0;
+            if (follow->sent < oldest) {
+                char note[64];
+                int len = snprintf(note, sizeof(note), "[... %llu bytes dropped ...]\n", oldest - follow->sent);
+                snprintf(header, sizeof(header), "output %d %d\n", job->job_id, len);
+                daemon_send(client, header, note, len);
+                follow->sent = oldest;
+            }
+            while (follow->sent < ring->total) {
+                size_t pos = follow->sent % ring->alloc;
+                size_t n = ring->alloc - pos;
+                if (n > ring->total - follow->sent) {
+                    n = ring->total - follow->sent;
+                }
+                snprintf(header, sizeof(header), "output %d %zu\n", job->job_id, n);
+                daemon_send(client, header, ring->data + pos, n);
+                follow->sent += n;
+            }
+            if (job->active || job->capture_fd != -1) {
+                continue;  // Still running, or output not fully drained yet
+            }
+            snprintf(header, sizeof(header), "exit %d %d\n", job->job_id, status_from_wait(job->exit_status));
+            daemon_send(client, header, NULL, 0);
+        }
+        daemon_follows[i--] = daemon_follows[--daemon_follow_count];
+    }
+}
+
+// Function to run at most one pending request per client (keeps clients fair)
+static void daemon_serve_requests() {
+    for (int i = 0; i < daemon_client_count; i++) {
+        DaemonClient *client = &daemon_clients[i];
+        if (client->closed || client->out.len > 0 || client->request_pid != 0) {
+            continue;  // Gone, or an earlier request is still running or being read
+        }
+        char *newline = memchr(client->in.data, '\n', client->in.len);
+        if (newline == NULL) {
+            continue;
+        }
+        int client_fd = client->fd;
+        size_t used = newline - client->in.data + 1;
+        char *request = strndup(client->in.data, used - 1);
+        memmove(client->in.data, client->in.data + used, client->in.len - used);
+        client->in.len -= used;
+
+        if (strncmp(request, "run ", 4) == 0) {
+            daemon_run(client, request + 4);
+        } else if (strcmp(request, "quit") == 0) {
+            daemon_client_gone(client);
+        } else {
+            daemon_run_inline(client, request);
+        }
+        free(request);
+        // A request may have accepted new clients and moved the table
+        client = find_client(client_fd);
+        i = client - daemon_clients;
+    }
+}
+
+// Function to drop finished jobs once their exit has been sent, or their client
+// is gone: every job in the daemon was started for a client, so nobody else
+// will ask for them and a long-running daemon would otherwise grow forever
+static void daemon_drop_jobs() {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].active || jobs[i].capture_fd != -1) {
+            continue;
+        }
+        int followed = 0;
+        for (int j = 0; j < daemon_follow_count; j++) {
+            if (daemon_follows[j].job_id == jobs[i].job_id) {
+                followed = 1;
+            }
+        }
+        if (!followed) {
+            drop_job(&jobs[i--]);
+        }
+    }
+}
+
+// Function to drop clients that went away, together with what they followed
+static void daemon_reap_clients() {
+    for (int i = 0; i < daemon_client_count; i++) {
+        if (!daemon_clients[i].closed || daemon_clients[i].request_pid != 0) {
+            continue;  // A request child is still collected through its client
+        }
+        close(daemon_clients[i].fd);
+        free(daemon_clients[i].in.data);
+        free(daemon_clients[i].out.data);
+        for (int j = 0; j < daemon_follow_count; j++) {
+            if (daemon_follows[j].client_fd == daemon_clients[i].fd) {
+                daemon_follows[j--] = daemon_follows[--daemon_follow_count];
+            }
+        }
+        daemon_clients[i--] = daemon_clients[--daemon_client_count];
+    }
+}
+
+static void daemon_stop_handler(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static void daemon_unlink_socket() {
+    if (daemon_socket_path != NULL && getpid() == daemon_pid) {
+        unlink(daemon_socket_path);
+    }
+}
+
+static int bind_unix_socket(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "quash: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Function to serve clients on a Unix socket until the daemon is told to exit
+int run_daemon(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (bind_unix_socket(path, &addr) == -1) {
+        return 2;
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        perror("socket");
+        return 1;
+    }
+    // Replace a stale socket left by a daemon that died, but never a regular file
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, 128) == -1) {
+        perror(path);
+        close(listen_fd);
+        return 1;
+    }
+    daemon_socket_path = path;
+    daemon_pid = getpid();
+    atexit(daemon_unlink_socket);
+
+    // No SA_RESTART: the signal has to cut the wait in event_loop_once short
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    init_event_loop();
+    event_add(listen_fd, daemon_accept, NULL);
+    out_printf(STDOUT_FILENO, "quash daemon listening on %s\n", path);
+    out_flush_all();
+
+    while (!daemon_stop) {
+        event_loop_once(-1, -1);
+        daemon_finish_requests();
+        daemon_serve_requests();
+        daemon_stream_jobs();
+        daemon_reap_clients();
+        daemon_drop_jobs();
+        out_flush_all();
+    }
+    close(listen_fd);
+    return 0;
+}
+
+// Function to read exactly len bytes of a reply payload
+static int reader_read_exact(LineReader *reader, char *dest, size_t len) {
+    while (len > 0) {
+        if (reader->start == reader->end) {
+            ssize_t n = read(reader->fd, reader->buf, sizeof(reader->buf));
+            if (n <= 0) {
+                return -1;
+            }
+            reader->start = 0;
+            reader->end = n;
+        }
+        size_t n = reader->end - reader->start;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(dest, reader->buf + reader->start, n);
+        reader->start += n;
+        dest += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Function to send one request to a daemon and print the replies
+// ('quash --socket PATH --send "run make all"'). Returns the command's status.
+int run_client(const char *path, const char *request) {
+    struct sockaddr_un addr;
+    if (bind_unix_socket(path, &addr) == -1) {
+        return 2;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(path);
+        return 2;
+    }
+    size_t len = strlen(request);
+    if (write(fd, request, len) != (ssize_t)len || write(fd, "\n", 1) != 1) {
+        perror("write");
+        return 2;
+    }
+
+    LineReader reader = { .fd = fd };
+    StrBuf line = {0};
+    int status = 2;
+    while (read_line(&reader, &line)) {
+        int job, code;
+        long long size;
+        if (sscanf(line.data, "output %d %lld", &job, &size) == 2 ||
+            sscanf(line.data, "result %d %lld", &code, &size) == 2) {
+            char *data = malloc(size > 0 ? size : 1);
+            if (data == NULL || reader_read_exact(&reader, data, size) == -1) {
+                free(data);
+                break;
+            }
+            out_write(STDOUT_FILENO, data, size);
+            free(data);
+            if (line.data[0] == 'r') {
+                status = code;
+                break;
+            }
+        } else if (sscanf(line.data, "exit %d %d", &job, &code) == 2) {
+            status = code;
+            break;
+        } else if (strncmp(line.data, "error ", 6) == 0) {
+            fprintf(stderr, "quash: %s", line.data + 6);
+            break;
+        }
+        // 'started' needs no action
+    }
+    out_flush_all();
+    free(line.data);
+    close(fd);
+    return status;
+}
+
+//============================================handle %++++++++++++++++++++++++++++++++++++++++++++++++++++
+void kill_job_by_id(int job_id) {
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].job_id == job_id && jobs[i].active) {
+            if (kill(job_target(&jobs[i]), SIGKILL) == 0) {  // Signal every process of the job
+                if (!rc_running) {
+                    out_printf(STDOUT_FILENO, "Job [%d] with PID %d has been terminated\n", job_id, jobs[i].pid);
+                }
+                wait_for_job(&jobs[i]);  // Collect them so 'jobs' shows the signal
+            } else {
+                perror("Failed to kill job by ID");
+            }
+            return;
+        }
+    }
+    out_printf(STDOUT_FILENO, "Job ID %d not found\n", job_id);
+
+}
+int handle_kill_command(char **args) {
+    if (args[1] != NULL) {
+        if (args[1][0] == '%') {  // Check if the argument starts with '%'
+            int job_id = atoi(args[1] + 1);  // Extract job ID after `%`
+            if (job_id > 0) {
+                kill_job_by_id(job_id);  // Call the function to kill by job ID
+            } else {
+                out_printf(STDOUT_FILENO, "Invalid job ID: %s\n", args[1]);
+            }
+        } else {
+            // Attempt to parse as a PID if no `%` found
+            int is_digit = 1;
+            for (int i = 0; args[1][i] != '\0'; i++) {
+                if (!isdigit(args[1][i])) {
+                    is_digit = 0;
+                    break;
+                }
+            }
+            if (is_digit) {
+                int pid = atoi(args[1]);  // Convert to PID
+                // Find and kill the job by PID if it matches an active job
+                for (int i = 0; i < job_count; i++) {
+                    if (jobs[i].pid == pid && jobs[i].active) {
+                        kill_job_by_id(jobs[i].job_id);
+                        return 1;
+                    }
+                }
+                out_printf(STDOUT_FILENO, "Process %d not found in active jobs list\n", pid);
+            } else {
+                out_printf(STDOUT_FILENO, "Invalid PID: %s\n", args[1]);
+            }
+        }
+    } else {
+        out_printf(STDOUT_FILENO, "Usage: kill <PID> or kill %%<JOBID>\n");
+    }
+    return 1;  // Return 1 to indicate handling of the command
+}
+
+
+// Function to kill a process by PID or JOBID
+void kill_process(char **args) {
+    if (args[1] == NULL) {
+        out_printf(STDOUT_FILENO, "Usage: kill <PID> or kill %%<JOBID>\n");
+        return;
+    }
+
+    if (args[1][0] == '%') {
+        // Parse as job ID if it starts with '%'
+        int job_id = atoi(args[1] + 1);  // Extract job ID from string after '%'
+        if (job_id > 0) {
+            kill_job_by_pid(job_id);
+        } else {
+            out_printf(STDOUT_FILENO, "Invalid job ID: %s\n", args[1]);
+        }
+    } else {
+        // Parse as PID if it doesn't start with '%'
+        int is_digit = 1;
+        for (int i = 0; args[1][i] != '\0'; i++) {
+            if (!isdigit(args[1][i])) {
+                is_digit = 0;
+                break;
+            }
+        }
+        if (is_digit) {
+            pid_t pid = atoi(args[1]);
+            if (kill(pid, SIGKILL) == 0) {  // Use SIGKILL for immediate termination
+                int status;
+                waitpid(pid, &status, 0);  // Wait for process termination
+                if (!rc_running) {
+                    out_printf(STDOUT_FILENO, "Process %d terminated\n", pid);
+                }
+                remove_job(pid);  // Mark the job as inactive
+            } else {
+                perror("kill");
+            }
+        } else {
+            out_printf(STDOUT_FILENO, "Invalid PID: %s\n", args[1]);
+        }
+    }
+}
+
+// Function to kill a job by job ID
+void kill_job_by_pid(int pid) {
+    int found = 0;
+    
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].pid == pid && jobs[i].active) {
+            if (kill(pid, SIGKILL) == 0) {  // Send SIGKILL to terminate
+                int status;
+                waitpid(pid, &status, 0);   // Wait for termination
+                if (!rc_running) {
+                    out_printf(STDOUT_FILENO, "Job with PID %d terminated\n", pid);
+                }
+                jobs[i].active = 0;         // Mark job as inactive
+            } else {
+                perror("Failed to kill job");
+            }
+            found = 1;
+            break;
+        }
+    }
+
+    if (!found) {
+        out_printf(STDOUT_FILENO, "No active job with PID %d found\n", pid);
+    }
+}
+// Function to handle the export command
+void export_variable(char *arg) {
+    char *delimiter = strchr(arg, '=');
+    if (delimiter == NULL) {
+        // 'export VAR' moves an existing shell variable into the environment
+        const char *current = lookup_variable(arg);
+        if (current == NULL) {
+            out_printf(STDOUT_FILENO, "Usage: export VAR=VALUE\n");
+            builtin_status = 1;
+            return;
+        }
+        char *value = strdup(current);
+        unset_shell_variable(arg);
+        if (value != NULL && setenv(arg, value, 1) == 0) {
+            if (!rc_running) {
+                out_printf(STDOUT_FILENO, "Exported: %s=%s\n", arg, value);
+            }
+        }
+        free(value);
+        return;
+    }
+
+    // Split the argument into VAR and VALUE
+    *delimiter = '\0';  // Temporarily terminate the string at '='
+    char *var_name = arg;
+    char *value = delimiter + 1;
+
+    // Set the environment variable
+    if (setenv(var_name, value, 1) == 0) {
+        unset_shell_variable(var_name);  // The environment copy wins from now on
+        if (!rc_running) {
+            out_printf(STDOUT_FILENO, "Exported: %s=%s\n", var_name, value);
+        }
+    } else {
+        perror("export failed");
+        builtin_status = 1;
+    }
+
+    *delimiter = '=';  // Restore the original argument string
+}
+// fucniton to handle find 
+void handle_find(char **args) {
+    pid_t pid = quash_fork();
+    if (pid == -1) {
+        perror("Fork failed for find command");
+        return;
+    } else if (pid == 0) {  // Child process
+        // If no specific path is provided, default to the current directory
+        char *path = (args[1] != NULL) ? args[1] : ".";
+        char *pattern = (args[2] != NULL) ? args[2] : "*";
+
+        // Execute the find command with provided path and pattern
+        execlp("find", "find", path, "-name", pattern, NULL);
+
+        // If exec fails
+        perror("Exec failed for find");
+        _exit(1);
     } else {  // Parent process
-        if (background) {
-            add_job(pid, args[0]);
-            
-            printf("Background job started: [%d] %d %s\n", job_count, pid, args[0]);
+        wait(NULL);  // Wait for child to finish
+    }
+}
+
+// fucntion to ahndle grep
+
+// Quotes around the pattern are already removed by word expansion
+void handle_grep(char **args) {
+    pid_t pid = quash_fork();
+    if (pid == -1) {
+        perror("Fork failed for grep command");
+        return;
+    } else if (pid == 0) {  // Child process
+        // Execute grep with the provided args directly
+        if (apply_redirections(args, NULL) == -1) {
+            _exit(1);
+        }
+        execvp("grep", args);
+
+        // If exec fails, print an error
+        perror("Exec failed for grep");
+        _exit(1);
+    } else {  // Parent process
+        builtin_status = status_from_wait(wait_for_child(pid));  // Wait for the child process to finish
+    }
+}
+//SOLVED CAT IN SEPRATE FILE AVGJEFNJKgknthkoiq4 o24h9-kporhkj
+void handle_cat(char **args) {
+    int in_fd = STDIN_FILENO;
+    int out_fd = STDOUT_FILENO;
+
+    // Parse args for redirection operators and set up input/output
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "<") == 0) {  // Input redirection
+            in_fd = open(args[i + 1], O_RDONLY);
+            if (in_fd == -1) {
+                perror("Failed to open input file");
+                return;
+            }
+            for (int j = i; args[j] != NULL; j++) {
+                args[j] = args[j + 2];
+            }
+            i--;
+        } else if (strcmp(args[i], ">") == 0) {  // Output redirection (overwrite)
+            out_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (out_fd == -1) {
+                perror("Failed to open output file for overwriting");
+                return;
+            }
+            for (int j = i; args[j] != NULL; j++) {
+                args[j] = args[j + 2];
+            }
+            i--;
+        } else if (strcmp(args[i], ">>") == 0) {  // Output redirection (append)
+            out_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (out_fd == -1) {
+                perror("Failed to open output file for appending");
+                return;
+            }
+            for (int j = i; args[j] != NULL; j++) {
+                args[j] = args[j + 2];
+            }
+            i--;
+        }
+    }
+
+    // Fork to handle reading and writing separately
+    pid_t pid = quash_fork();
+    if (pid == -1) {
+        perror("Fork failed");
+        return;
+    } else if (pid == 0) {  // Child process for reading and writing
+        // Redirect stdin if needed
+        if (in_fd != STDIN_FILENO) {
+            if (dup2(in_fd, STDIN_FILENO) == -1) {
+                perror("Failed to redirect stdin");
+                exit(1);
+            }
+            close(in_fd);
+        }
+
+        // Redirect stdout if needed
+        if (out_fd != STDOUT_FILENO) {
+            if (dup2(out_fd, STDOUT_FILENO) == -1) {
+                perror("Failed to redirect stdout");
+                exit(1);
+            }
+            close(out_fd);
+        }
+
+        // Process files if specified, or read from stdin if none
+        if (args[1] == NULL) {
+            char buffer[1024];
+            ssize_t bytes_read;
+            while ((bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
+                if (write(STDOUT_FILENO, buffer, bytes_read) == -1) {
+                    perror("Failed to write to output");
+                    break;
+                }
+            }
+        } else {
+            // Loop through each file and read contents
+            for (int i = 1; args[i] != NULL; i++) {
+                int fd = open(args[i], O_RDONLY);
+                if (fd == -1) {
+                    perror("Failed to open input file");
+                    continue;
+                }
+
+                // Read file and write contents
+                char buffer[1024];
+                ssize_t bytes_read;
+                while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+                    if (write(STDOUT_FILENO, buffer, bytes_read) == -1) {
+                        perror("Failed to write to output");
+                        close(fd);
+                        return;
+                    }
+                }
+                close(fd);  // Close each file after reading
+            }
+        }
+        _exit(0);  // Exit child process
+    } else {  // Parent process
+        if (out_fd != STDOUT_FILENO) {
+            close(out_fd);
+        }
+        builtin_status = status_from_wait(wait_for_child(pid));  // Wait for child to finish
+    }
+}
+
+
+//============================================sort++++++++++++++++++++++++++++++++++++++++++++++++++++
+// 'sort' reads its input in buffers of up to -S bytes (text plus line table).
+// Each buffer is split at line boundaries between threads; every thread builds
+// the line table of its part and sorts it with an MSD radix sort on an 8-byte key
+// prefix, comparing whole keys only inside buckets the prefix cannot split. When
+// the input does not fit, the sorted parts are merged into a run in a temporary
+// file (unlinked right away) and the buffer is reused. At the end the runs and the
+// last buffer's parts are merged with a loser tree. Lines compare bytewise, as
+// GNU sort does with LC_ALL=C.
+
+#define SORT_MAX_KEYS 8
+
+typedef struct {
+    int start_field;   // 1-based
+    int start_char;    // 1-based within the field, 0 for its start
+    int end_field;     // 0 for the end of the line
+    int end_char;      // Last character (inclusive), 0 for the end of the field
+    int numeric;
+    int reverse;
+    int start_blanks;  // Skip leading blanks of the start field (b on the start position)
+    int end_blanks;    // ... and of the end field (b on the end position), as in GNU sort
+    int has_flags;     // Had its own n/r/b, so the global ones do not apply
+} SortKey;
+
+typedef struct {
+    SortKey keys[SORT_MAX_KEYS];  // keys[0] also decides the prefix
+    int key_count;
+    int separator;     // -t character, -1 for blank to non-blank transitions
+    int numeric;       // Global -n, -r and -b, inherited by keys without flags
+    int reverse;
+    int blanks;
+    int unique;
+} SortSpec;
+
+typedef struct {
+    uint64_t prefix;   // Integer order agrees with sort_compare whenever prefixes differ
+    const char *text;  // Line without its '\n'
+    size_t len;
+} SortLine;
+
+// Part of a buffer sorted by one thread
+typedef struct {
+    const SortSpec *spec;
+    const char *from;  // Whole lines, each ending in '\n'
+    const char *to;
+    SortLine *lines;
+    size_t count;
+} SortSlice;
+
+// Input of a merge: a sorted slice or a run file
+typedef struct {
+    const SortSpec *spec;
+    SortLine line;     // Current line, valid until the next sort_source_next
+    int done;
+    const SortLine *lines;
+    size_t count;
+    size_t pos;
+    int fd;            // -1 for a slice
+    char *buf;
+    size_t size;
+    size_t start;
+    size_t end;
+    int eof;
+} SortSource;
+
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    int error;
+} SortWriter;
+
+static int is_sort_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Function to skip to the start of field number field (1-based)
+static const char *sort_field_start(const char *p, const char *end, int field, int separator) {
+    for (int i = 1; i < field && p < end; i++) {
+        if (separator >= 0) {
+            const char *sep = memchr(p, separator, end - p);
+            p = sep != NULL ? sep + 1 : end;
         } else {
-            waitpid(pid, NULL, 0);  // Wait for foreground process to finish
+            while (p < end && is_sort_blank(*p)) {
+                p++;
+            }
+            while (p < end && !is_sort_blank(*p)) {
+                p++;
+            }
         }
     }
+    return p;
 }
 
-// Function to add a job to the job list
-void add_job(pid_t pid, char *command) {
-    printf("Adding job: PID = %d, Command = %s\n", pid, command);  // Debugging: Print the job being added
-
-    if (job_count < MAX_JOBS) {
-        jobs[job_count].job_id = job_count + 1;
-        jobs[job_count].pid = pid;
-        strcpy(jobs[job_count].command, command);
-        jobs[job_count].active = 1;
-        
-       // printf("Job added successfully. Job ID = %d, PID = %d, Command = %s\n", 
-               //jobs[job_count].job_id, jobs[job_count].pid, jobs[job_count].command);  // Confirm job details
-        
-        job_count++;
-    } else {
-        printf("Failed to add job: Maximum job limit reached\n");
+// Function to find the end of the field starting at p
+static const char *sort_field_end(const char *p, const char *end, int separator) {
+    if (separator >= 0) {
+        const char *sep = memchr(p, separator, end - p);
+        return sep != NULL ? sep : end;
+    }
+    while (p < end && is_sort_blank(*p)) {
+        p++;
     }
+    while (p < end && !is_sort_blank(*p)) {
+        p++;
+    }
+    return p;
 }
-// Function to print currently running jobs
-void print_jobs() {
-    int jobs_found = 0;  // Track if any job exists
 
-    for (int i = 0; i < job_count; i++) {
-        // Check if the job is active and if it has completed
-        if (jobs[i].active) {
-            int status;
-            pid_t result = waitpid(jobs[i].pid, &status, WNOHANG);
-            
-            if (result != 0) {  // If the job is no longer running
-                if (WIFEXITED(status)) {
-                    jobs[i].active = 0;  // Mark job as inactive
-                    jobs[i].command[MAX_INPUT_SIZE - 1] = '\0';  // Safeguard string
-                    printf("[%d] %d %s - Completed\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
-                } else if (WIFSIGNALED(status)) {
-                    jobs[i].active = 0;  // Mark job as inactive
-                    printf("[%d] %d %s - Terminated by signal %d\n", jobs[i].job_id, jobs[i].pid, jobs[i].command, WTERMSIG(status));
+// Function to find where a key lies in a line
+static void sort_key_bounds(const SortKey *key, int separator, const char *text, size_t len,
+                            const char **key_start, const char **key_end) {
+    const char *end = text + len;
+    const char *s = sort_field_start(text, end, key->start_field, separator);
+    if (key->start_blanks) {
+        while (s < end && is_sort_blank(*s)) {
+            s++;
+        }
+    }
+    // Character positions may run past the field, as in GNU sort
+    if (key->start_char > 1) {
+        s = (end - s > key->start_char - 1) ? s + key->start_char - 1 : end;
+    }
+
+    const char *e = end;
+    if (key->end_field > 0) {
+        e = sort_field_start(text, end, key->end_field, separator);
+        if (key->end_char == 0) {
+            e = sort_field_end(e, end, separator);
+        } else {
+            if (key->end_blanks) {
+                while (e < end && is_sort_blank(*e)) {
+                    e++;
                 }
-            } else {
-                // Job is still running
-                printf("[%d] %d %s - Running\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
             }
-            jobs_found = 1;
+            e = (end - e > key->end_char) ? e + key->end_char : end;
+        }
+    }
+    *key_start = s;
+    *key_end = e < s ? s : e;
+}
+
+// Function to split a number ([blanks][-]digits[.digits]) into its significant
+// integer and fraction digits. Returns 1 for a negative non-zero number.
+static int sort_parse_number(const char *p, const char *end, const char **int_start, const char **int_end,
+                             const char **frac_start, const char **frac_end) {
+    int negative = 0;
+    while (p < end && is_sort_blank(*p)) {
+        p++;
+    }
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    while (p < end && *p == '0') {
+        p++;
+    }
+    *int_start = p;
+    while (p < end && isdigit((unsigned char)*p)) {
+        p++;
+    }
+    *int_end = p;
+    *frac_start = *frac_end = p;
+    if (p < end && *p == '.') {
+        *frac_start = ++p;
+        while (p < end && isdigit((unsigned char)*p)) {
+            p++;
+        }
+        while (p > *frac_start && p[-1] == '0') {
+            p--;  // Trailing zeros do not change the value
+        }
+        *frac_end = p;
+    }
+    if (*int_start == *int_end && *frac_start == *frac_end) {
+        negative = 0;  // -0 is 0
+    }
+    return negative;
+}
+
+// Function to compare two numbers the way 'sort -n' does, digit by digit
+static int sort_compare_numbers(const char *a, const char *a_end, const char *b, const char *b_end) {
+    const char *ai, *ai_end, *af, *af_end;
+    const char *bi, *bi_end, *bf, *bf_end;
+    int a_negative = sort_parse_number(a, a_end, &ai, &ai_end, &af, &af_end);
+    int b_negative = sort_parse_number(b, b_end, &bi, &bi_end, &bf, &bf_end);
+    if (a_negative != b_negative) {
+        return a_negative ? -1 : 1;
+    }
+
+    int result;
+    size_t a_len = ai_end - ai;
+    size_t b_len = bi_end - bi;
+    if (a_len != b_len) {
+        result = a_len < b_len ? -1 : 1;
+    } else if ((result = memcmp(ai, bi, a_len)) == 0) {
+        size_t af_len = af_end - af;
+        size_t bf_len = bf_end - bf;
+        result = memcmp(af, bf, af_len < bf_len ? af_len : bf_len);
+        if (result == 0 && af_len != bf_len) {
+            result = af_len < bf_len ? -1 : 1;
+        }
+    }
+    return a_negative ? -result : result;
+}
+
+static int sort_compare_bytes(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int result = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (result == 0 && a_len != b_len) {
+        result = a_len < b_len ? -1 : 1;
+    }
+    return result;
+}
+
+// Function to compute a line's prefix from its first key. For text it is the first
+// 8 bytes; for numbers the sign, the integer digit count and the first 14 digits,
+// so integer comparison of prefixes never contradicts the full comparison.
+static uint64_t sort_prefix(const SortSpec *spec, const char *text, size_t len) {
+    const SortKey *key = &spec->keys[0];
+    const char *start;
+    const char *end;
+    uint64_t prefix = 0;
+
+    sort_key_bounds(key, spec->separator, text, len, &start, &end);
+    if (!key->numeric) {
+        for (int i = 0; i < 8; i++) {
+            prefix = (prefix << 8) | (start + i < end ? (unsigned char)start[i] : 0);
+        }
+    } else {
+        const char *ip, *ip_end, *fp, *fp_end;
+        int negative = sort_parse_number(start, end, &ip, &ip_end, &fp, &fp_end);
+        size_t int_len = ip_end - ip;
+        if (int_len > 126) {
+            prefix = 0xFFULL << 56;  // Too long to order by its digits here
         } else {
-            // If job is inactive, we previously marked it as completed or terminated
-            printf("[%d] %d %s - Completed\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
-            jobs_found = 1;
+            prefix = (uint64_t)(0x80 + int_len) << 56;
+            for (int shift = 52; shift >= 0; shift -= 4) {
+                int digit = 0;
+                if (ip < ip_end) {
+                    digit = *ip++ - '0';
+                } else if (fp < fp_end) {
+                    digit = *fp++ - '0';
+                }
+                prefix |= (uint64_t)digit << shift;
+            }
+        }
+        if (negative) {
+            prefix = ~prefix;
         }
     }
+    return key->reverse ? ~prefix : prefix;
+}
 
-    if (!jobs_found) {
-        printf("No jobs found\n");
+// Function to compare two lines: keys in order, then (without -u) the whole lines
+static int sort_compare(const SortSpec *spec, const SortLine *a, const SortLine *b) {
+    if (a->prefix != b->prefix) {
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    for (int i = 0; i < spec->key_count; i++) {
+        const SortKey *key = &spec->keys[i];
+        const char *as, *ae, *bs, *be;
+        sort_key_bounds(key, spec->separator, a->text, a->len, &as, &ae);
+        sort_key_bounds(key, spec->separator, b->text, b->len, &bs, &be);
+        int result = key->numeric ? sort_compare_numbers(as, ae, bs, be)
+                                  : sort_compare_bytes(as, ae - as, bs, be - bs);
+        if (result != 0) {
+            return key->reverse ? -result : result;
+        }
+    }
+    if (spec->unique) {
+        return 0;  // -u: lines with equal keys are duplicates
     }
+    int result = sort_compare_bytes(a->text, a->len, b->text, b->len);
+    return spec->reverse ? -result : result;
 }
-// Function to check for completed background jobs
-void check_background_jobs() {
-    for (int i = 0; i < job_count; i++) {
-        if (jobs[i].active) {
-            int status;
-            pid_t result = waitpid(jobs[i].pid, &status, WNOHANG);  // Check if the job has finished
-            if (result == 0) {
-                // The job is still running (waitpid returns 0)
-                continue;
-            } else if (result == jobs[i].pid) {
-                // The job has finished (waitpid returns the PID)
-                printf("Completed: [%d] %d %s\n", jobs[i].job_id, jobs[i].pid, jobs[i].command);
-                jobs[i].active = 0;  // Mark the job as inactive
-            } else if (result == -1) {
-                // An error occurred (this shouldn't usually happen unless the job doesn't exist)
-                perror("waitpid");
+
+// Function to order lines of one buffer: equal lines keep their input order, so
+// -u keeps the first of them
+static int sort_compare_stable(const void *a, const void *b, void *spec) {
+    const SortLine *x = a;
+    const SortLine *y = b;
+    int result = sort_compare(spec, x, y);
+    if (result == 0) {
+        result = (x->text > y->text) - (x->text < y->text);
+    }
+    return result;
+}
+
+// Function to sort lines by prefix byte number byte (0 = most significant),
+// finishing with comparisons once buckets are small or the prefix is used up
+static void sort_radix(const SortSpec *spec, SortLine *lines, size_t n, int byte) {
+    if (n < 32) {
+        for (size_t i = 1; i < n; i++) {
+            SortLine line = lines[i];
+            size_t j = i;
+            while (j > 0 && sort_compare_stable(&lines[j - 1], &line, (void *)spec) > 0) {
+                lines[j] = lines[j - 1];
+                j--;
+            }
+            lines[j] = line;
+        }
+        return;
+    }
+    if (byte == 8) {
+        qsort_r(lines, n, sizeof(SortLine), sort_compare_stable, (void *)spec);
+        return;
+    }
+
+    int shift = 56 - 8 * byte;
+    size_t count[256] = {0};
+    size_t next[256];
+    size_t end[256];
+    for (size_t i = 0; i < n; i++) {
+        count[(lines[i].prefix >> shift) & 0xFF]++;
+    }
+    if (count[(lines[0].prefix >> shift) & 0xFF] == n) {
+        sort_radix(spec, lines, n, byte + 1);  // All in one bucket
+        return;
+    }
+    size_t offset = 0;
+    for (int b = 0; b < 256; b++) {
+        next[b] = offset;
+        offset += count[b];
+        end[b] = offset;
+    }
+    // Move every line straight into its bucket, cycle by cycle
+    for (int b = 0; b < 256; b++) {
+        while (next[b] < end[b]) {
+            SortLine line = lines[next[b]];
+            int digit = (line.prefix >> shift) & 0xFF;
+            while (digit != b) {
+                SortLine displaced = lines[next[digit]];
+                lines[next[digit]++] = line;
+                line = displaced;
+                digit = (line.prefix >> shift) & 0xFF;
             }
+            lines[next[b]++] = line;
+        }
+    }
+    for (int b = 0; b < 256; b++) {
+        if (count[b] > 1) {
+            sort_radix(spec, lines + end[b] - count[b], count[b], byte + 1);
         }
     }
 }
 
-// Function to remove a job from the job list (not used but could be useful)
-// Function to remove a job from the job list by marking it inactive
-// Function to remove a job from the job list by marking it inactive
-void remove_job(pid_t pid) {
-    for (int i = 0; i < job_count; i++) {
-        if (jobs[i].pid == pid) {
-            jobs[i].active = 0;
-            break;
+// Function run by each thread: build the line table of a slice and sort it
+static void *sort_slice_thread(void *arg) {
+    SortSlice *slice = arg;
+    size_t count = 0;
+    for (const char *p = slice->from; p < slice->to; p++) {
+        p = memchr(p, '\n', slice->to - p);
+        count++;
+    }
+    slice->lines = malloc((count > 0 ? count : 1) * sizeof(SortLine));
+    if (slice->lines == NULL) {
+        slice->count = 0;
+        return NULL;
+    }
+    const char *p = slice->from;
+    for (size_t i = 0; i < count; i++) {
+        const char *newline = memchr(p, '\n', slice->to - p);
+        slice->lines[i].text = p;
+        slice->lines[i].len = newline - p;
+        slice->lines[i].prefix = sort_prefix(slice->spec, p, newline - p);
+        p = newline + 1;
+    }
+    slice->count = count;
+    sort_radix(slice->spec, slice->lines, count, 0);
+    return NULL;
+}
+
+// Function to sort a buffer of whole lines in up to nthreads slices. Returns the
+// number of slices, or -1 when memory ran out.
+static int sort_buffer(const SortSpec *spec, const char *text, size_t len, int nthreads, SortSlice *slices) {
+    pthread_t threads[SORT_MAX_THREADS];
+    int started[SORT_MAX_THREADS] = {0};
+    int nslices = 0;
+
+    if ((size_t)nthreads > len / (64 << 10) + 1) {
+        nthreads = len / (64 << 10) + 1;  // Small inputs are not worth a thread
+    }
+    const char *from = text;
+    for (int i = 0; i < nthreads && from < text + len; i++) {
+        const char *to = text + len * (i + 1) / nthreads;
+        if (to < from) {
+            to = from;
+        }
+        if (to < text + len) {
+            to = (const char *)memchr(to, '\n', text + len - to) + 1;  // Buffers end in '\n'
+        }
+        slices[nslices].spec = spec;
+        slices[nslices].from = from;
+        slices[nslices].to = to;
+        slices[nslices].lines = NULL;
+        slices[nslices].count = 0;
+        nslices++;
+        from = to;
+    }
+    for (int i = 1; i < nslices; i++) {
+        started[i] = (pthread_create(&threads[i], NULL, sort_slice_thread, &slices[i]) == 0);
+    }
+    if (nslices > 0) {
+        sort_slice_thread(&slices[0]);
+    }
+    int failed = 0;
+    for (int i = 0; i < nslices; i++) {
+        if (i > 0 && started[i]) {
+            pthread_join(threads[i], NULL);
+        } else if (i > 0) {
+            sort_slice_thread(&slices[i]);  // No thread to spare: do it here
+        }
+        failed |= (slices[i].lines == NULL);
+    }
+    if (failed) {
+        for (int i = 0; i < nslices; i++) {
+            free(slices[i].lines);
         }
+        return -1;
     }
+    return nslices;
 }
-//============================================handle %++++++++++++++++++++++++++++++++++++++++++++++++++++
-void kill_job_by_id(int job_id) {
-    for (int i = 0; i < job_count; i++) {
-        if (jobs[i].job_id == job_id && jobs[i].active) {
-            if (kill(jobs[i].pid, SIGKILL) == 0) {  // Send SIGKILL signal to the process
-                printf("Job [%d] with PID %d has been terminated\n", job_id, jobs[i].pid);
-                jobs[i].active = 0;  // Mark job as inactive
-            } else {
-                perror("Failed to kill job by ID");
+
+// Function to write data out completely (a closed pipe just ends the output)
+static void sort_write(SortWriter *w, const char *data, size_t len) {
+    while (len > 0 && !w->error) {
+        ssize_t n = write(w->fd, data, len);
+        if (n < 0 && errno != EINTR) {
+            if (errno != EPIPE) {
+                perror("sort: write");
             }
+            w->error = 1;
+        } else if (n > 0) {
+            data += n;
+            len -= n;
+        }
+    }
+}
+
+static void sort_flush(SortWriter *w) {
+    sort_write(w, w->buf, w->len);
+    w->len = 0;
+}
+
+static void sort_write_line(SortWriter *w, const char *text, size_t len) {
+    if (w->len + len + 1 > SORT_IO_SIZE) {
+        sort_flush(w);
+        if (len + 1 > SORT_IO_SIZE) {
+            sort_write(w, text, len);  // Longer than the buffer: straight out
+            w->buf[w->len++] = '\n';
             return;
         }
     }
-    printf("Job ID %d not found\n", job_id);
+    memcpy(w->buf + w->len, text, len);
+    w->len += len;
+    w->buf[w->len++] = '\n';
+}
 
+// Function to load the next line of a merge input. Returns 0 once it is used up.
+static int sort_source_next(SortSource *src) {
+    if (src->fd == -1) {
+        if (src->pos == src->count) {
+            src->done = 1;
+            return 0;
+        }
+        src->line = src->lines[src->pos++];
+        return 1;
+    }
+    while (1) {
+        char *newline = memchr(src->buf + src->start, '\n', src->end - src->start);
+        if (newline != NULL) {
+            src->line.text = src->buf + src->start;
+            src->line.len = newline - (src->buf + src->start);
+            src->line.prefix = sort_prefix(src->spec, src->line.text, src->line.len);
+            src->start = newline + 1 - src->buf;
+            return 1;
+        }
+        if (src->eof) {
+            src->done = 1;  // Runs are written by us and always end in '\n'
+            return 0;
+        }
+        memmove(src->buf, src->buf + src->start, src->end - src->start);
+        src->end -= src->start;
+        src->start = 0;
+        if (src->end == src->size) {
+            char *grown = realloc(src->buf, src->size * 2);  // A very long line
+            if (grown == NULL) {
+                perror("sort: realloc");
+                src->done = 1;
+                return 0;
+            }
+            src->buf = grown;
+            src->size *= 2;
+        }
+        ssize_t n = read(src->fd, src->buf + src->end, src->size - src->end);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0) {
+                perror("sort: read");
+            }
+            src->eof = 1;
+        } else {
+            src->end += n;
+        }
+    }
 }
-int handle_kill_command(char **args) {
-    if (args[1] != NULL) {
-        if (args[1][0] == '%') {  // Check if the argument starts with '%'
-            int job_id = atoi(args[1] + 1);  // Extract job ID after `%`
-            if (job_id > 0) {
-                kill_job_by_id(job_id);  // Call the function to kill by job ID
+
+// Function to check whether merge input a should come out before b (done inputs
+// last, ties to the earlier input, k is a virtual input that wins everything)
+static int sort_beats(SortSource *sources, int k, int a, int b) {
+    if (a == k || b == k) {
+        return a == k;
+    }
+    if (sources[a].done || sources[b].done) {
+        return sources[b].done && !sources[a].done;
+    }
+    int result = sort_compare(sources[a].spec, &sources[a].line, &sources[b].line);
+    return result != 0 ? result < 0 : a < b;
+}
+
+// Function to replay the matches on the way from input s to the root of the loser tree
+static void loser_tree_adjust(int *tree, SortSource *sources, int k, int s) {
+    for (int t = (s + k) / 2; t > 0; t /= 2) {
+        if (sort_beats(sources, k, tree[t], s)) {
+            int winner = tree[t];  // The loser stays, the winner plays on
+            tree[t] = s;
+            s = winner;
+        }
+    }
+    tree[0] = s;
+}
+
+// Function to merge k sorted inputs into w with a loser tree: tree[0] holds the
+// smallest current line, tree[1..k-1] the loser of each match, so replacing the
+// winner costs one comparison per level
+static int sort_merge(const SortSpec *spec, SortSource *sources, int k, SortWriter *w) {
+    int *tree = malloc((k > 0 ? k : 1) * sizeof(int));
+    if (tree == NULL) {
+        perror("sort: malloc");
+        return -1;
+    }
+    for (int i = 0; i < k; i++) {
+        tree[i] = k;
+        sort_source_next(&sources[i]);
+    }
+    for (int i = k - 1; i >= 0; i--) {
+        loser_tree_adjust(tree, sources, k, i);
+    }
+
+    StrBuf last = {0};  // Last line written, for -u
+    SortLine last_line;
+    int have_last = 0;
+    while (k > 0 && !sources[tree[0]].done && !w->error) {
+        SortSource *src = &sources[tree[0]];
+        if (!spec->unique || !have_last || sort_compare(spec, &last_line, &src->line) != 0) {
+            sort_write_line(w, src->line.text, src->line.len);
+            if (spec->unique) {
+                last.len = 0;
+                strbuf_putn(&last, src->line.text, src->line.len);
+                last_line = src->line;
+                last_line.text = last.data;
+                have_last = 1;
+            }
+        }
+        sort_source_next(src);
+        loser_tree_adjust(tree, sources, k, tree[0]);
+    }
+    free(last.data);
+    free(tree);
+    return w->error ? -1 : 0;
+}
+
+// Function to open an anonymous temporary file for a run
+static int sort_temp_file() {
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/quash-sortXXXXXX", dir != NULL && *dir != '\0' ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("sort: temporary file");
+        return -1;
+    }
+    unlink(path);  // Gone as soon as it is closed
+    return fd;
+}
+
+// Function to set up merge inputs: first the run files, then the slices
+static SortSource *sort_sources(const SortSpec *spec, int *runs, int nruns, SortSlice *slices, int nslices) {
+    SortSource *sources = calloc(nruns + nslices + 1, sizeof(SortSource));
+    if (sources == NULL) {
+        perror("sort: calloc");
+        return NULL;
+    }
+    for (int i = 0; i < nruns; i++) {
+        sources[i].spec = spec;
+        sources[i].fd = runs[i];
+        sources[i].size = SORT_IO_SIZE;
+        sources[i].buf = malloc(SORT_IO_SIZE);
+        if (sources[i].buf == NULL || lseek(runs[i], 0, SEEK_SET) == -1) {
+            perror("sort: run");
+            for (int j = 0; j <= i; j++) {
+                free(sources[j].buf);
+            }
+            free(sources);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < nslices; i++) {
+        SortSource *src = &sources[nruns + i];
+        src->spec = spec;
+        src->fd = -1;
+        src->lines = slices[i].lines;
+        src->count = slices[i].count;
+    }
+    return sources;
+}
+
+// Function to merge runs and slices into fd. Returns -1 on failure.
+static int sort_merge_into(const SortSpec *spec, int fd, int *runs, int nruns, SortSlice *slices, int nslices) {
+    SortSource *sources = sort_sources(spec, runs, nruns, slices, nslices);
+    SortWriter w = { fd, malloc(SORT_IO_SIZE), 0, 0 };
+    int result = -1;
+    if (sources != NULL && w.buf != NULL) {
+        result = sort_merge(spec, sources, nruns + nslices, &w);
+        if (result == 0) {
+            sort_flush(&w);
+            result = w.error ? -1 : 0;
+        }
+    } else if (w.buf == NULL) {
+        perror("sort: malloc");
+    }
+    for (int i = 0; sources != NULL && i < nruns; i++) {
+        free(sources[i].buf);
+    }
+    free(sources);
+    free(w.buf);
+    return result;
+}
+
+// Function to parse a -k key: F[.C][bnr][,F[.C][bnr]]
+static int sort_parse_key(const char *text, SortKey *key) {
+    char *end;
+    memset(key, 0, sizeof(SortKey));
+    key->start_field = strtol(text, &end, 10);
+    if (end == text || key->start_field < 1) {
+        return -1;
+    }
+    if (*end == '.') {
+        key->start_char = strtol(end + 1, &end, 10);
+        if (key->start_char < 1) {
+            return -1;
+        }
+    }
+    for (int part = 0; part < 2; part++) {
+        while (*end == 'b' || *end == 'n' || *end == 'r') {
+            // b belongs to the position it follows; n and r to the whole key
+            if (*end == 'b') {
+                *(part == 0 ? &key->start_blanks : &key->end_blanks) = 1;
+            }
+            key->numeric |= (*end == 'n');
+            key->reverse |= (*end == 'r');
+            key->has_flags = 1;
+            end++;
+        }
+        if (part == 1 || *end != ',') {
+            break;
+        }
+        const char *field = end + 1;
+        key->end_field = strtol(field, &end, 10);
+        if (end == field || key->end_field < 1) {
+            return -1;
+        }
+        if (*end == '.') {
+            key->end_char = strtol(end + 1, &end, 10);
+            if (key->end_char < 0) {
+                return -1;
+            }
+        }
+    }
+    return *end == '\0' ? 0 : -1;
+}
+
+// Function to fill buf with whole lines from the inputs: stops once the text and its
+// line table would pass budget. *done is set when every input has been read, or
+// with *failed when one could not be.
+static size_t sort_fill(char **buf, size_t *cap, size_t len, size_t budget, char **inputs, int *input, int *fd,
+                        int *done, int *failed) {
+    size_t lines = 0;
+    for (const char *p = *buf; (p = memchr(p, '\n', *buf + len - p)) != NULL; p++) {
+        lines++;
+    }
+    while (len + lines * sizeof(SortLine) < budget || lines == 0) {
+        if (*fd == -1) {
+            const char *name = inputs[*input];
+            if (name == NULL) {
+                *done = 1;
+                break;
+            }
+            *fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+            if (*fd == -1) {
+                fprintf(stderr, "sort: %s: %s\n", name, strerror(errno));
+                *done = *failed = 1;
+                break;
+            }
+        }
+        if (len + 1 >= *cap) {
+            char *grown = realloc(*buf, *cap * 2);  // A line longer than the buffer
+            if (grown == NULL) {
+                perror("sort: realloc");
+                *done = *failed = 1;
+                break;
+            }
+            *buf = grown;
+            *cap *= 2;
+        }
+        size_t want = *cap - len - 1;  // Room for a '\n' the last line may lack
+        ssize_t n = read(*fd, *buf + len, want < SORT_IO_SIZE ? want : SORT_IO_SIZE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0) {
+                fprintf(stderr, "sort: %s: %s\n", inputs[*input], strerror(errno));
+                *done = *failed = 1;
+                break;
+            }
+            if (len > 0 && (*buf)[len - 1] != '\n') {
+                (*buf)[len++] = '\n';  // Every input ends a line
+                lines++;
+            }
+            if (*fd != STDIN_FILENO) {
+                close(*fd);
+            }
+            *fd = -1;
+            (*input)++;
+            continue;
+        }
+        for (const char *p = *buf + len; (p = memchr(p, '\n', *buf + len + n - p)) != NULL; p++) {
+            lines++;
+        }
+        len += n;
+    }
+    return len;
+}
+
+// Function to run 'sort' in this process. Returns its exit status.
+static int sort_main(char **args) {
+    SortSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.separator = -1;
+    rlim_t budget = SORT_MEMORY_DEFAULT;
+    const char *output = NULL;
+    const char *input_redirect = NULL;
+    int out_flags = O_TRUNC;
+    ArgList inputs = {0};
+    int options_done = 0;
+
+    // Number of CPUs this process may use (so taskset and @cpus= are honored)
+    cpu_set_t allowed;
+    int nthreads = 1;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        nthreads = CPU_COUNT(&allowed);
+    }
+
+    for (int i = 1; args[i] != NULL; i++) {
+        const char *arg = args[i];
+        if (strcmp(arg, "<") == 0 || strcmp(arg, ">") == 0 || strcmp(arg, ">>") == 0) {
+            if (args[i + 1] == NULL) {
+                fprintf(stderr, "No file specified for redirection\n");
+                arglist_free(&inputs);
+                return 2;
+            }
+            if (arg[0] == '<') {
+                input_redirect = args[++i];
             } else {
-                printf("Invalid job ID: %s\n", args[1]);
+                out_flags = arg[1] == '>' ? O_APPEND : O_TRUNC;
+                output = args[++i];
             }
+        } else if (options_done || arg[0] != '-' || arg[1] == '\0') {
+            arglist_push(&inputs, strdup(arg));
+        } else if (strcmp(arg, "--") == 0) {
+            options_done = 1;
+        } else if (strncmp(arg, "--parallel=", 11) == 0) {
+            nthreads = atoi(arg + 11);
         } else {
-            // Attempt to parse as a PID if no `%` found
-            int is_digit = 1;
-            for (int i = 0; args[1][i] != '\0'; i++) {
-                if (!isdigit(args[1][i])) {
-                    is_digit = 0;
-                    break;
+            for (const char *opt = arg + 1; *opt != '\0'; opt++) {
+                if (*opt == 'n' || *opt == 'r' || *opt == 'u' || *opt == 'b') {
+                    spec.numeric |= (*opt == 'n');
+                    spec.reverse |= (*opt == 'r');
+                    spec.unique |= (*opt == 'u');
+                    spec.blanks |= (*opt == 'b');
+                    continue;
                 }
-            }
-            if (is_digit) {
-                int pid = atoi(args[1]);  // Convert to PID
-                // Find and kill the job by PID if it matches an active job
-                for (int i = 0; i < job_count; i++) {
-                    if (jobs[i].pid == pid && jobs[i].active) {
-                        kill_job_by_id(jobs[i].job_id);
-                        return 1;
+                if (strchr("ktSo", *opt) == NULL) {
+                    fprintf(stderr, "sort: invalid option -- '%c'\n", *opt);
+                    arglist_free(&inputs);
+                    return 2;
+                }
+                // Options with a value take the rest of the word or the next one
+                const char *value = opt[1] != '\0' ? opt + 1 : args[++i];
+                if (value == NULL) {
+                    fprintf(stderr, "sort: option requires an argument -- '%c'\n", *opt);
+                    arglist_free(&inputs);
+                    return 2;
+                }
+                if (*opt == 'k') {
+                    if (spec.key_count == SORT_MAX_KEYS || sort_parse_key(value, &spec.keys[spec.key_count]) == -1) {
+                        fprintf(stderr, "sort: invalid key: %s\n", value);
+                        arglist_free(&inputs);
+                        return 2;
+                    }
+                    spec.key_count++;
+                } else if (*opt == 't') {
+                    if (value[0] == '\0' || value[1] != '\0') {
+                        fprintf(stderr, "sort: separator must be one character: %s\n", value);
+                        arglist_free(&inputs);
+                        return 2;
                     }
+                    spec.separator = (unsigned char)value[0];
+                } else if (*opt == 'S') {
+                    if (parse_limit_value(value, LIMIT_SIZE, &budget) == -1) {
+                        fprintf(stderr, "sort: invalid buffer size: %s\n", value);
+                        arglist_free(&inputs);
+                        return 2;
+                    }
+                } else {
+                    output = value;
                 }
-                printf("Process %d not found in active jobs list\n", pid);
-            } else {
-                printf("Invalid PID: %s\n", args[1]);
+                break;
             }
         }
-    } else {
-        printf("Usage: kill <PID> or kill %%<JOBID>\n");
     }
-    return 1;  // Return 1 to indicate handling of the command
-}
 
+    if (spec.key_count == 0) {
+        spec.keys[0].start_field = 1;  // The whole line
+        spec.key_count = 1;
+    }
+    for (int i = 0; i < spec.key_count; i++) {
+        if (!spec.keys[i].has_flags) {
+            spec.keys[i].numeric = spec.numeric;
+            spec.keys[i].reverse = spec.reverse;
+            spec.keys[i].start_blanks = spec.blanks;
+            spec.keys[i].end_blanks = spec.blanks;
+        }
+    }
+    if (budget < (64 << 10)) {
+        budget = 64 << 10;
+    }
+    if (budget > SIZE_MAX / 2) {
+        budget = SIZE_MAX / 2;
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    } else if (nthreads > SORT_MAX_THREADS) {
+        nthreads = SORT_MAX_THREADS;
+    }
+    if (input_redirect != NULL) {
+        arglist_push(&inputs, strdup(input_redirect));
+    } else if (inputs.count == 0) {
+        arglist_push(&inputs, strdup("-"));
+    }
+    arglist_push(&inputs, NULL);
 
-// Function to kill a process by PID or JOBID
-void kill_process(char **args) {
-    if (args[1] == NULL) {
-        printf("Usage: kill <PID> or kill %%<JOBID>\n");
-        return;
+    // Budget-sized buffer: only the part holding text is ever touched
+    size_t cap = budget;
+    char *buf = malloc(cap);
+    int runs[SORT_MERGE_WAY];
+    int nruns = 0;
+    SortSlice slices[SORT_MAX_THREADS];
+    int nslices = 0;
+    int input = 0;
+    int fd = -1;
+    int done = 0;
+    int failed = 0;
+    size_t len = 0;
+    int status = 0;
+    if (buf == NULL) {
+        perror("sort: malloc");
+        arglist_free(&inputs);
+        return 2;
     }
 
-    if (args[1][0] == '%') {
-        // Parse as job ID if it starts with '%'
-        int job_id = atoi(args[1] + 1);  // Extract job ID from string after '%'
-        if (job_id > 0) {
-            kill_job_by_pid(job_id);
-        } else {
-            printf("Invalid job ID: %s\n", args[1]);
+    while (!done) {
+        len = sort_fill(&buf, &cap, len, budget, inputs.items, &input, &fd, &done, &failed);
+        if (failed) {
+            status = 2;
+            break;
         }
-    } else {
-        // Parse as PID if it doesn't start with '%'
-        int is_digit = 1;
-        for (int i = 0; args[1][i] != '\0'; i++) {
-            if (!isdigit(args[1][i])) {
-                is_digit = 0;
+        size_t whole = len;
+        while (whole > 0 && buf[whole - 1] != '\n') {
+            whole--;  // A partial last line waits for the next buffer
+        }
+        nslices = sort_buffer(&spec, buf, whole, nthreads, slices);
+        if (nslices < 0) {
+            perror("sort: malloc");
+            nslices = 0;
+            status = 2;
+            break;
+        }
+        if (done) {
+            break;  // The last buffer is merged straight into the output
+        }
+
+        // Spill a run; with SORT_MERGE_WAY runs waiting, merge them into one first
+        if (nruns == SORT_MERGE_WAY) {
+            int merged = sort_temp_file();
+            if (merged == -1 || sort_merge_into(&spec, merged, runs, nruns, NULL, 0) == -1) {
+                if (merged != -1) {
+                    close(merged);
+                }
+                status = 2;
                 break;
             }
+            for (int i = 0; i < nruns; i++) {
+                close(runs[i]);
+            }
+            runs[0] = merged;
+            nruns = 1;
         }
-        if (is_digit) {
-            pid_t pid = atoi(args[1]);
-            if (kill(pid, SIGKILL) == 0) {  // Use SIGKILL for immediate termination
-                int status;
-                waitpid(pid, &status, 0);  // Wait for process termination
-                printf("Process %d terminated\n", pid);
-                remove_job(pid);  // Mark the job as inactive
-            } else {
-                perror("kill");
+        int run = sort_temp_file();
+        if (run == -1 || sort_merge_into(&spec, run, NULL, 0, slices, nslices) == -1) {
+            if (run != -1) {
+                close(run);
             }
-        } else {
-            printf("Invalid PID: %s\n", args[1]);
+            status = 2;
+            break;
+        }
+        runs[nruns++] = run;
+        for (int i = 0; i < nslices; i++) {
+            free(slices[i].lines);
         }
+        nslices = 0;
+        memmove(buf, buf + whole, len - whole);
+        len -= whole;
     }
-}
 
-// Function to kill a job by job ID
-void kill_job_by_pid(int pid) {
-    int found = 0;
-    
-    for (int i = 0; i < job_count; i++) {
-        if (jobs[i].pid == pid && jobs[i].active) {
-            if (kill(pid, SIGKILL) == 0) {  // Send SIGKILL to terminate
-                int status;
-                waitpid(pid, &status, 0);   // Wait for termination
-                printf("Job with PID %d terminated\n", pid);
-                jobs[i].active = 0;         // Mark job as inactive
-            } else {
-                perror("Failed to kill job");
+    if (status == 0) {
+        int out_fd = STDOUT_FILENO;
+        if (output != NULL) {
+            // Opened only now: 'sort -o file file' must read file first
+            out_fd = open(output, O_WRONLY | O_CREAT | out_flags, 0644);
+            if (out_fd == -1) {
+                perror("Failed to open output file");
+                status = 2;
             }
-            found = 1;
-            break;
+        }
+        if (out_fd != -1 && sort_merge_into(&spec, out_fd, runs, nruns, slices, nslices) == -1) {
+            status = 2;
+        }
+        if (out_fd != -1 && out_fd != STDOUT_FILENO) {
+            close(out_fd);
         }
     }
 
-    if (!found) {
-        printf("No active job with PID %d found\n", pid);
+    for (int i = 0; i < nslices; i++) {
+        free(slices[i].lines);
+    }
+    for (int i = 0; i < nruns; i++) {
+        close(runs[i]);
     }
+    if (fd != -1 && fd != STDIN_FILENO) {
+        close(fd);
+    }
+    free(buf);
+    arglist_free(&inputs);
+    return status;
 }
-// Function to handle the export command
-void export_variable(char *arg) {
-    char *delimiter = strchr(arg, '=');
-    if (delimiter == NULL) {
-        printf("Usage: export VAR=VALUE\n");
+
+// Built-in function to handle 'sort [-nrub] [-k KEY]... [-t SEP] [-S SIZE] [-o FILE] [FILE...]'.
+// It runs in a child like any foreground job, so Ctrl-C and Ctrl-Z work on it.
+void quash_sort(char **args) {
+    if (in_subshell) {
+        builtin_status = sort_main(args);  // Already a pipeline stage or job of its own
+        return;
+    }
+    pid_t pid = fork_job(job_group_for(0), job_control);
+    if (pid == 0) {
+        _exit(sort_main(args));
+    } else if (pid < 0) {
+        perror("fork failed");
+        builtin_status = 1;
         return;
     }
+    builtin_status = wait_for_foreground(&pid, 1, "sort");
+}
 
-    // Split the argument into VAR and VALUE
-    *delimiter = '\0';  // Temporarily terminate the string at '='
-    char *var_name = arg;
-    char *value = delimiter + 1;
 
-    // Set the environment variable
-    if (setenv(var_name, value, 1) == 0) {
-        printf("Exported: %s=%s\n", var_name, value);
-    } else {
-        perror("export failed");
-    }
+//============================================buffered builtin output++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Builtins write into a per-fd buffer instead of calling printf/write for every
+// small piece. The buffer is flushed with a single writev when it fills up, at the
+// end of each command, and before every fork so children never inherit it.
 
-    *delimiter = '=';  // Restore the original argument string
+// Function to write an iovec array completely, retrying on short writes
+static int write_all_iov(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Skip over the iovecs (or part of one) that made it out
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
 }
-// fucniton to handle find 
-void handle_find(char **args) {
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("Fork failed for find command");
-        return;
-    } else if (pid == 0) {  // Child process
-        // If no specific path is provided, default to the current directory
-        char *path = (args[1] != NULL) ? args[1] : ".";
-        char *pattern = (args[2] != NULL) ? args[2] : "*";
 
-        // Execute the find command with provided path and pattern
-        execlp("find", "find", path, "-name", pattern, NULL);
+// Function to flush one buffer slot, optionally followed by extra data in the same writev
+static void out_flush_slot(OutBuf *ob, const char *extra, size_t extra_len) {
+    struct iovec iov[2];
+    int iovcnt = 0;
 
-        // If exec fails
-        perror("Exec failed for find");
-        _exit(1);
-    } else {  // Parent process
-        wait(NULL);  // Wait for child to finish
+    if (ob->len > 0) {
+        iov[iovcnt].iov_base = ob->data;
+        iov[iovcnt].iov_len = ob->len;
+        iovcnt++;
+    }
+    if (extra_len > 0) {
+        iov[iovcnt].iov_base = (void *)extra;
+        iov[iovcnt].iov_len = extra_len;
+        iovcnt++;
+    }
+    int failed = (iovcnt > 0 && write_all_iov(ob->fd, iov, iovcnt) == -1 && errno != EPIPE);
+    ob->len = 0;  // Cleared first: perror below flushes stdout again
+    if (failed) {
+        perror("write");
     }
 }
 
-// fucntion to ahndle grep
+// Function to find (or claim) the buffer slot for fd
+static OutBuf *out_get(int fd) {
+    static int next_victim = 0;
 
-char* remove_quotesforgrep(char* arg) {
-    size_t len = strlen(arg);
-    if (len > 1 && ((arg[0] == '\'' && arg[len - 1] == '\'') || (arg[0] == '\"' && arg[len - 1] == '\"'))) {
-        // Remove the first and last character (quotes)
-        arg[len - 1] = '\0';  // Remove the closing quote
-        return arg + 1;       // Skip the opening quote
+    if (!out_bufs_ready) {
+        for (int i = 0; i < OUT_MAX_FDS; i++) {
+            out_bufs[i].fd = -1;
+            out_bufs[i].len = 0;
+        }
+        out_bufs_ready = 1;
     }
-    return arg;  // Return the argument unchanged if no quotes are found
-}
-char *remove_quotesforGREP(char *arg) {
-    size_t len = strlen(arg);
-    if (len >= 2 && ((arg[0] == '\'' && arg[len - 1] == '\'') || (arg[0] == '\"' && arg[len - 1] == '\"'))) {
-        arg[len - 1] = '\0';  // Remove the closing quote
-        return arg + 1;       // Return pointer to skip the opening quote
+
+    OutBuf *free_slot = NULL;
+    for (int i = 0; i < OUT_MAX_FDS; i++) {
+        if (out_bufs[i].fd == fd) {
+            return &out_bufs[i];
+        }
+        if (out_bufs[i].fd == -1 && free_slot == NULL) {
+            free_slot = &out_bufs[i];
+        }
     }
-    return arg;  // Return unchanged if no surrounding quotes
-}
 
-// Function to apply remove_quotes to all arguments in args array
-void process_args_quotes(char **args) {
-    for (int i = 0; args[i] != NULL; i++) {
-        args[i] = remove_quotesforGREP(args[i]);  // Remove quotes from each argument
+    // All slots busy: flush one and hand it over
+    if (free_slot == NULL) {
+        free_slot = &out_bufs[next_victim];
+        next_victim = (next_victim + 1) % OUT_MAX_FDS;
+        out_flush_slot(free_slot, NULL, 0);
     }
+    free_slot->fd = fd;
+    free_slot->len = 0;
+    return free_slot;
 }
 
-void handle_grep(char **args) {
-    // Debug: Print the arguments
-   
-    process_args_quotes(args);
-    //printf("Debug: Arguments passed to grep:\n");
-    for (int i = 0; args[i] != NULL; i++) {
-       // printf("args[%d] = %s\n", i, args[i]);
+// Function to append raw bytes to the output buffer of fd
+void out_write(int fd, const char *data, size_t len) {
+    OutBuf *ob = out_get(fd);
+
+    if (ob->len + len <= OUT_BUF_SIZE) {
+        memcpy(ob->data + ob->len, data, len);
+        ob->len += len;
+        if (ob->len == OUT_BUF_SIZE) {
+            out_flush_slot(ob, NULL, 0);
+        }
+        return;
     }
 
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("Fork failed for grep command");
+    // Doesn't fit: send what is buffered and the new data together
+    out_flush_slot(ob, data, len);
+}
+
+// Function to append formatted text to the output buffer of fd
+void out_printf(int fd, const char *fmt, ...) {
+    OutBuf *ob = out_get(fd);
+    size_t room = OUT_BUF_SIZE - ob->len;
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(ob->data + ob->len, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
         return;
-    } else if (pid == 0) {  // Child process
-        // Execute grep with the provided args directly
-        execvp("grep", args);
+    }
+    if ((size_t)n < room) {
+        ob->len += n;
+        return;
+    }
 
-        // If exec fails, print an error
-        perror("Exec failed for grep");
-        _exit(1);
-    } else {  // Parent process
-        wait(NULL);  // Wait for the child process to finish
+    // Didn't fit in the space left: format into a temporary and append that
+    char *tmp = malloc(n + 1);
+    if (tmp == NULL) {
+        perror("malloc failed for output");
+        return;
     }
+    va_start(ap, fmt);
+    vsnprintf(tmp, n + 1, fmt, ap);
+    va_end(ap);
+    out_write(fd, tmp, n);
+    free(tmp);
 }
-//SOLVED CAT IN SEPRATE FILE AVGJEFNJKgknthkoiq4 o24h9-kporhkj
-void handle_cat(char **args) {
-    int in_fd = STDIN_FILENO;
-    int out_fd = STDOUT_FILENO;
 
-    // Parse args for redirection operators and set up input/output
-    for (int i = 1; args[i] != NULL; i++) {
-        if (strcmp(args[i], "<") == 0) {  // Input redirection
-            in_fd = open(args[i + 1], O_RDONLY);
-            if (in_fd == -1) {
-                perror("Failed to open input file");
-                return;
-            }
-            for (int j = i; args[j] != NULL; j++) {
-                args[j] = args[j + 2];
-            }
-            i--;
-        } else if (strcmp(args[i], ">") == 0) {  // Output redirection (overwrite)
-            out_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (out_fd == -1) {
-                perror("Failed to open output file for overwriting");
-                return;
-            }
-            for (int j = i; args[j] != NULL; j++) {
-                args[j] = args[j + 2];
-            }
-            i--;
-        } else if (strcmp(args[i], ">>") == 0) {  // Output redirection (append)
-            out_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_APPEND, 0644);
-            if (out_fd == -1) {
-                perror("Failed to open output file for appending");
-                return;
-            }
-            for (int j = i; args[j] != NULL; j++) {
-                args[j] = args[j + 2];
-            }
-            i--;
+// Function to flush buffered output for a single fd
+void out_flush(int fd) {
+    if (!out_bufs_ready) {
+        return;
+    }
+    for (int i = 0; i < OUT_MAX_FDS; i++) {
+        if (out_bufs[i].fd == fd) {
+            out_flush_slot(&out_bufs[i], NULL, 0);
+            return;
         }
     }
+}
 
-    // Fork to handle reading and writing separately
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("Fork failed");
+// Function to flush every buffered fd
+void out_flush_all() {
+    if (!out_bufs_ready) {
         return;
-    } else if (pid == 0) {  // Child process for reading and writing
-        // Redirect stdin if needed
-        if (in_fd != STDIN_FILENO) {
-            if (dup2(in_fd, STDIN_FILENO) == -1) {
-                perror("Failed to redirect stdin");
-                exit(1);
-            }
-            close(in_fd);
+    }
+    for (int i = 0; i < OUT_MAX_FDS; i++) {
+        if (out_bufs[i].fd != -1) {
+            out_flush_slot(&out_bufs[i], NULL, 0);
         }
+    }
+}
 
-        // Redirect stdout if needed
-        if (out_fd != STDOUT_FILENO) {
-            if (dup2(out_fd, STDOUT_FILENO) == -1) {
-                perror("Failed to redirect stdout");
-                exit(1);
+// Function to flush and release the buffer of fd, then close it
+void out_close(int fd) {
+    if (out_bufs_ready) {
+        for (int i = 0; i < OUT_MAX_FDS; i++) {
+            if (out_bufs[i].fd == fd) {
+                out_flush_slot(&out_bufs[i], NULL, 0);
+                out_bufs[i].fd = -1;
+                break;
             }
-            close(out_fd);
         }
+    }
+    close(fd);
+}
 
-        // Process files if specified, or read from stdin if none
-        if (args[1] == NULL) {
-            char buffer[1024];
-            ssize_t bytes_read;
-            while ((bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
-                if (write(STDOUT_FILENO, buffer, bytes_read) == -1) {
-                    perror("Failed to write to output");
-                    break;
-                }
-            }
-        } else {
-            // Loop through each file and read contents
-            for (int i = 1; args[i] != NULL; i++) {
-                int fd = open(args[i], O_RDONLY);
-                if (fd == -1) {
-                    perror("Failed to open input file");
-                    continue;
-                }
+// Function used as the write hook of stderr: buffered stdout goes out first so
+// that messages and the errors after them appear in the order they were produced
+static ssize_t stderr_write(void *cookie, const char *data, size_t len) {
+    (void)cookie;
+    out_flush(STDOUT_FILENO);
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(STDERR_FILENO, data + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return done > 0 ? (ssize_t)done : -1;
+        }
+        done += n;
+    }
+    return done;
+}
 
-                // Read file and write contents
-                char buffer[1024];
-                ssize_t bytes_read;
-                while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-                    if (write(STDOUT_FILENO, buffer, bytes_read) == -1) {
-                        perror("Failed to write to output");
-                        close(fd);
-                        return;
-                    }
-                }
-                close(fd);  // Close each file after reading
+// Function to send everything written to stderr (perror, fprintf) through stderr_write
+void out_order_stderr() {
+    cookie_io_functions_t io = { .write = stderr_write };
+    FILE *err = fopencookie(NULL, "w", io);
+    if (err != NULL) {
+        setvbuf(err, NULL, _IONBF, 0);
+        stderr = err;
+    }
+}
+
+// Function to fork without duplicating pending output into the child
+pid_t quash_fork() {
+    return fork_job(-1, 0);
+}
+
+// Function to fork a job process. pgid -1 keeps the shell's process group, 0
+// starts a new group led by the child, anything else joins that group. Both
+// sides set the group (and hand over the terminal for a foreground job) so
+// neither the exec nor a following kill can race ahead of it.
+pid_t fork_job(pid_t pgid, int foreground) {
+    out_flush_all();
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (pgid != -1) {
+            setpgid(0, pgid);
+            if (foreground) {
+                tcsetpgrp(STDIN_FILENO, getpgrp());  // SIGTTOU is still ignored here
             }
         }
-        _exit(0);  // Exit child process
-    } else {  // Parent process
-        if (out_fd != STDOUT_FILENO) {
-            close(out_fd);
+        reset_child_events();
+    } else if (pid > 0 && pgid != -1) {
+        setpgid(pid, pgid ? pgid : pid);
+        if (foreground) {
+            tcsetpgrp(STDIN_FILENO, pgid ? pgid : pid);
         }
-        wait(NULL);  // Wait for child to finish
     }
+    return pid;
 }